@@ -0,0 +1,206 @@
+// A pool-backed parallel version of std::accumulate
+//
+// Compared with Listing 2.9 this version
+// - runs its blocks on the persistent workers of a thread_pool instead of
+//   spawning fresh threads on every call,
+// - keeps every partial result in its own cache line,
+// - sizes blocks from the measured cost per element instead of a hard-coded
+//   `min_per_thread`,
+// - passes exceptions thrown in a block back to the caller.
+#include "../ch04_synchronizing_concurrent_operations/demo_4_5.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using steady_clock = std::chrono::steady_clock;
+
+#ifdef __cpp_lib_hardware_interference_size
+constexpr std::size_t cache_line_size =
+    std::hardware_destructive_interference_size;
+#else
+constexpr std::size_t cache_line_size = 64;
+#endif
+
+template <typename T> struct alignas(cache_line_size) padded_result {
+    T value;
+};
+
+thread_pool &default_pool() {
+    static thread_pool pool;
+    return pool;
+}
+
+// A block should run at least this long, otherwise handing it to another
+// thread costs more than it saves.
+constexpr std::chrono::nanoseconds min_block_time(50'000);
+// Number of elements summed on the calling thread to measure the cost per
+// element.
+constexpr unsigned long sample_size = 1024;
+
+// Running estimate of the cost of one element, shared by all calls with the
+// same iterator and value types.
+template <typename Iterator, typename T> struct element_cost {
+    static inline std::atomic<double> ns_per_element{0.0};
+
+    static void update(double sample) {
+        double old = ns_per_element.load(std::memory_order_relaxed);
+        ns_per_element.store(old == 0.0 ? sample : (old * 7 + sample) / 8,
+                             std::memory_order_relaxed);
+    }
+};
+
+template <typename Iterator, typename T>
+T parallel_accumulate(thread_pool &pool, Iterator first, Iterator last,
+                      T init) {
+    unsigned long length = std::distance(first, last);
+
+    // Sum a short prefix here: it is part of the result anyway and tells us
+    // how expensive an element is.
+    const unsigned long sampled = std::min(length, sample_size);
+    Iterator sample_end = first;
+    std::advance(sample_end, sampled);
+    auto t_start = steady_clock::now();
+    init = std::accumulate(first, sample_end, init);
+    auto elapse = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        steady_clock::now() - t_start);
+    if (sampled != 0) {
+        element_cost<Iterator, T>::update(double(elapse.count()) / sampled);
+    }
+    first = sample_end;
+    length -= sampled;
+
+    const double ns_per_element = std::max(
+        element_cost<Iterator, T>::ns_per_element.load(
+            std::memory_order_relaxed),
+        0.01);
+    const unsigned long min_per_block = std::max(
+        1ul, static_cast<unsigned long>(min_block_time.count() /
+                                        ns_per_element));
+    const unsigned long max_blocks = length / min_per_block;
+    // one block for every worker, and one for the calling thread
+    const unsigned long num_blocks =
+        std::min<unsigned long>(pool.size() + 1, max_blocks);
+    if (num_blocks <= 1) {
+        return std::accumulate(first, last, init);
+    }
+    const unsigned long block_size = length / num_blocks;
+
+    std::vector<padded_result<T>> results(num_blocks);
+    std::vector<std::future<void>> futures(num_blocks - 1);
+    Iterator block_start = first;
+    for (unsigned long i = 0; i < (num_blocks - 1); ++i) {
+        Iterator block_end = block_start;
+        std::advance(block_end, block_size);
+        futures[i] = pool.submit([=, &results] {
+            results[i].value = std::accumulate(block_start, block_end, T());
+        });
+        block_start = block_end;
+    }
+
+    std::exception_ptr error;
+    try {
+        results[num_blocks - 1].value =
+            std::accumulate(block_start, last, T());
+    } catch (...) {
+        error = std::current_exception();
+    }
+    // every block must be finished before `results` goes away, so only the
+    // first exception is kept and rethrown once all of them are done
+    for (auto &future : futures) {
+        pool.wait(future);
+        try {
+            future.get();
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    for (const auto &result : results) {
+        init = init + result.value;
+    }
+    return init;
+}
+
+template <typename Iterator, typename T>
+T parallel_accumulate(Iterator first, Iterator last, T init) {
+    return parallel_accumulate(default_pool(), first, last, init);
+}
+
+struct throwing_value {
+    long value;
+
+    throwing_value(long v = 0) : value(v) {}
+
+    friend throwing_value operator+(const throwing_value &lhs,
+                                    const throwing_value &rhs) {
+        if (rhs.value < 0) {
+            throw std::runtime_error("negative value");
+        }
+        return throwing_value(lhs.value + rhs.value);
+    }
+};
+
+int main() {
+    const long n = 10'000'000;
+    std::vector<long> vi(n, 1);
+
+    long sum = 0;
+    auto t_start = steady_clock::now();
+    sum = parallel_accumulate(vi.begin(), vi.end(), 0L);
+    auto elapse = std::chrono::duration_cast<std::chrono::milliseconds>(
+        steady_clock::now() - t_start);
+    std::cout << "parallel version: sum = " << sum << ", took "
+              << elapse.count() << "ms" << std::endl;
+
+    t_start = steady_clock::now();
+    sum = std::accumulate(vi.begin(), vi.end(), 0L);
+    elapse = std::chrono::duration_cast<std::chrono::milliseconds>(
+        steady_clock::now() - t_start);
+    std::cout << "serial version: sum = " << sum << ", took "
+              << elapse.count() << "ms" << std::endl;
+
+    // many small reductions: the workers are reused between calls
+    const int calls = 10'000;
+    std::vector<long> small(20'000, 1);
+    t_start = steady_clock::now();
+    for (int i = 0; i < calls; ++i) {
+        sum = parallel_accumulate(small.begin(), small.end(), 0L);
+    }
+    elapse = std::chrono::duration_cast<std::chrono::milliseconds>(
+        steady_clock::now() - t_start);
+    std::cout << calls << " calls on " << small.size()
+              << " elements: sum = " << sum << ", took " << elapse.count()
+              << "ms" << std::endl;
+
+    // past the sampled prefix, in the first block: a pool worker throws and
+    // the exception has to come back through its future
+    std::vector<throwing_value> tv(n, throwing_value(1));
+    tv[sample_size + 10].value = -1;
+    std::string message;
+    try {
+        parallel_accumulate(tv.begin(), tv.end(), throwing_value());
+    } catch (const std::exception &e) {
+        message = e.what();
+    }
+    std::cout << "exception from a block: " << message << std::endl;
+    if (message != "negative value") {
+        std::cerr << "expected \"negative value\"" << std::endl;
+        return 1;
+    }
+}
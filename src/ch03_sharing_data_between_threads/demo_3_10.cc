@@ -0,0 +1,108 @@
+// Listing 3.1 on top of a concurrent hash set
+//
+// `add_to_list` and `list_contains` keep their interface, but the keys live
+// in a concurrent_hash_set instead of a mutex-guarded std::list: lookups are
+// O(1) and don't block each other or the writers.
+//
+// usage: demo_3_10 [max reader threads] [number of keys]
+// After the Listing 3.1 scenario the program measures lookups per second
+// with 1, 2, 4 ... readers while one thread keeps inserting, for the hash set
+// and for a std::mutex guarding a std::unordered_set.
+#include "demo_3_9.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+concurrent_hash_set<int> some_set;
+
+void add_to_list(int new_value) { some_set.insert(new_value); }
+
+bool list_contains(int value_to_find) { return some_set.contains(value_to_find); }
+
+struct mutex_set {
+    std::unordered_set<int> data;
+    mutable std::mutex mtx;
+
+    void insert(int v) {
+        std::lock_guard<std::mutex> guard(mtx);
+        data.insert(v);
+    }
+
+    bool contains(int v) const {
+        std::lock_guard<std::mutex> guard(mtx);
+        return data.count(v) != 0;
+    }
+};
+
+// Returns million lookups per second over all readers.
+template <typename Set> double lookup_rate(int readers, int keys) {
+    Set set;
+    for (int i = 0; i < keys / 2; ++i) {
+        set.insert(i);
+    }
+    std::atomic<bool> done(false);
+    std::atomic<long> lookups(0);
+    std::thread writer([&] {
+        for (int i = keys / 2; i < keys && !done; ++i) {
+            set.insert(i);
+        }
+    });
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r] {
+            long n = 0;
+            for (int i = r; !done; i = (i + 7919) % keys, ++n) {
+                set.contains(i);
+            }
+            lookups += n;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    done = true;
+    writer.join();
+    for (auto &t : threads) {
+        t.join();
+    }
+    return lookups / 200'000.0;
+}
+
+int main(int argc, char *argv[]) {
+    const int N = 20;
+    std::thread t1([] {
+        for (int i = 0; i <= N; ++i) {
+            add_to_list(i);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+
+    std::thread t2([] {
+        for (int i = N; i >= 0; --i) {
+            std::cout << "list contains " << i << ": " << std::boolalpha
+                      << list_contains(i) << std::endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+
+    t1.join();
+    t2.join();
+
+    const int max_readers =
+        argc > 1 ? std::atoi(argv[1])
+                 : std::max(1u, std::thread::hardware_concurrency());
+    const int keys = argc > 2 ? std::atoi(argv[2]) : 2'000'000;
+    std::cout << "\nmillion lookups/s while one thread inserts\n"
+              << "readers\tmutex + unordered_set\tconcurrent_hash_set"
+              << std::endl;
+    for (int readers = 1; readers <= max_readers; readers *= 2) {
+        std::cout << readers << '\t' << lookup_rate<mutex_set>(readers, keys)
+                  << "\t\t\t"
+                  << lookup_rate<concurrent_hash_set<int>>(readers, keys)
+                  << std::endl;
+    }
+}
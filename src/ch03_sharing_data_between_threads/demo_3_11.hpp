@@ -0,0 +1,161 @@
+// Read-copy-update for read-mostly data
+//
+// Readers never take a lock. `read()` records the current epoch in a slot
+// that belongs to the calling thread alone (one cache line per thread), so
+// readers never write to a cache line that another thread writes, then use
+// the currently published snapshot, which is immutable.
+//
+// Writers are serialized by a mutex. `update()` copies the snapshot, applies
+// the change to the copy and publishes it with a single pointer store. The
+// old snapshot is freed after a grace period: the writer bumps the epoch and
+// waits until no reader is still inside a read section it entered earlier.
+#ifndef RCU_PROTECTED_HPP
+#define RCU_PROTECTED_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace rcu {
+
+constexpr unsigned max_threads = 128;
+
+inline std::atomic<bool> thread_index_in_use[max_threads];
+
+// Every thread that reads gets a small index, returned when it exits.
+class thread_index {
+private:
+    unsigned index;
+
+public:
+    thread_index() {
+        for (index = 0; index < max_threads; ++index) {
+            bool expected = false;
+            if (thread_index_in_use[index].compare_exchange_strong(expected,
+                                                                   true)) {
+                return;
+            }
+        }
+        throw std::runtime_error("too many rcu reader threads");
+    }
+
+    thread_index(const thread_index &) = delete;
+    thread_index &operator=(const thread_index &) = delete;
+
+    ~thread_index() { thread_index_in_use[index].store(false); }
+
+    unsigned get() const { return index; }
+};
+
+inline unsigned this_thread_index() {
+    thread_local thread_index index;
+    return index.get();
+}
+
+} // namespace rcu
+
+template <typename T> class rcu_protected {
+private:
+    static constexpr std::size_t cache_line_size = 64;
+
+    struct alignas(cache_line_size) reader_slot {
+        // 0 outside of a read section, else the epoch seen on entry
+        std::atomic<std::uint64_t> epoch{0};
+        // nesting depth of read sections, only touched by the owner thread
+        unsigned depth = 0;
+    };
+
+    std::atomic<const T *> current;
+    alignas(cache_line_size) std::atomic<std::uint64_t> global_epoch;
+    std::mutex writer_mtx;
+    reader_slot slots[rcu::max_threads];
+
+    void read_lock(reader_slot &slot) {
+        if (slot.depth++ == 0) {
+            slot.epoch.store(global_epoch.load(std::memory_order_acquire),
+                             std::memory_order_relaxed);
+            // the store above must be visible before we read `current`,
+            // see synchronize()
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    void read_unlock(reader_slot &slot) {
+        if (--slot.depth == 0) {
+            slot.epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    // Waits until every reader that might still see the old snapshot has
+    // left its read section.
+    void synchronize() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const std::uint64_t epoch = global_epoch.fetch_add(1) + 1;
+        for (auto &slot : slots) {
+            for (;;) {
+                const std::uint64_t e = slot.epoch.load(std::memory_order_acquire);
+                if (e == 0 || e >= epoch) {
+                    break;
+                }
+                std::this_thread::yield();
+            }
+        }
+    }
+
+public:
+    class read_guard {
+    private:
+        rcu_protected *owner;
+        reader_slot *slot;
+        const T *snapshot;
+
+    public:
+        explicit read_guard(rcu_protected &owner_)
+            : owner(&owner_), slot(&owner_.slots[rcu::this_thread_index()]) {
+            owner->read_lock(*slot);
+            snapshot = owner->current.load(std::memory_order_acquire);
+        }
+
+        read_guard(const read_guard &) = delete;
+        read_guard &operator=(const read_guard &) = delete;
+
+        ~read_guard() { owner->read_unlock(*slot); }
+
+        const T &operator*() const { return *snapshot; }
+        const T *operator->() const { return snapshot; }
+    };
+
+    explicit rcu_protected(T initial = T())
+        : current(new T(std::move(initial))), global_epoch(1) {}
+
+    rcu_protected(const rcu_protected &) = delete;
+    rcu_protected &operator=(const rcu_protected &) = delete;
+
+    ~rcu_protected() { delete current.load(); }
+
+    // The snapshot stays valid, and unchanged, while the guard lives.
+    read_guard read() { return read_guard(*this); }
+
+    template <typename Function> auto read(Function f) {
+        read_guard guard(*this);
+        return f(*guard);
+    }
+
+    // Applies `f` to a copy of the data and publishes the copy.
+    template <typename Function> void update(Function f) {
+        std::lock_guard<std::mutex> lk(writer_mtx);
+        const T *old = current.load(std::memory_order_relaxed);
+        std::unique_ptr<T> copy(new T(*old));
+        f(*copy);
+        current.store(copy.release(), std::memory_order_release);
+        synchronize();
+        delete old;
+    }
+};
+
+#endif // end of RCU_PROTECTED_HPP
@@ -0,0 +1,117 @@
+// Reader scaling of Listing 3.1's list_contains: std::mutex vs.
+// std::shared_mutex vs. rcu_protected
+//
+// usage: demo_3_12 [max reader threads]
+// Readers call list_contains in a loop while one writer calls add_to_list
+// every millisecond. Reported is the total number of lookups per second.
+#include "demo_3_11.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+const int initial_size = 64;
+
+class mutex_list {
+private:
+    std::list<int> some_list;
+    std::mutex some_mtx;
+
+public:
+    void add_to_list(int new_value) {
+        std::lock_guard<std::mutex> guard(some_mtx);
+        some_list.push_back(new_value);
+    }
+
+    bool list_contains(int value_to_find) {
+        std::lock_guard<std::mutex> guard(some_mtx);
+        return std::find(some_list.begin(), some_list.end(), value_to_find) !=
+               some_list.end();
+    }
+};
+
+class shared_mutex_list {
+private:
+    std::list<int> some_list;
+    std::shared_mutex some_mtx;
+
+public:
+    void add_to_list(int new_value) {
+        std::lock_guard<std::shared_mutex> guard(some_mtx);
+        some_list.push_back(new_value);
+    }
+
+    bool list_contains(int value_to_find) {
+        std::shared_lock<std::shared_mutex> guard(some_mtx);
+        return std::find(some_list.begin(), some_list.end(), value_to_find) !=
+               some_list.end();
+    }
+};
+
+class rcu_list {
+private:
+    rcu_protected<std::list<int>> some_list;
+
+public:
+    void add_to_list(int new_value) {
+        some_list.update([&](std::list<int> &l) { l.push_back(new_value); });
+    }
+
+    bool list_contains(int value_to_find) {
+        auto snapshot = some_list.read();
+        return std::find(snapshot->begin(), snapshot->end(), value_to_find) !=
+               snapshot->end();
+    }
+};
+
+// Returns million lookups per second.
+template <typename List> double lookup_rate(int readers) {
+    List list;
+    for (int i = 0; i < initial_size; ++i) {
+        list.add_to_list(i);
+    }
+    std::atomic<bool> done(false);
+    std::atomic<long> lookups(0);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r] {
+            long n = 0;
+            for (int i = r; !done; ++i, ++n) {
+                list.list_contains(i % (2 * initial_size));
+            }
+            lookups += n;
+        });
+    }
+    std::thread writer([&] {
+        for (int i = initial_size; !done; ++i) {
+            list.add_to_list(i % initial_size);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    const auto duration = std::chrono::milliseconds(200);
+    std::this_thread::sleep_for(duration);
+    done = true;
+    writer.join();
+    for (auto &t : threads) {
+        t.join();
+    }
+    return lookups / (duration.count() * 1000.0);
+}
+
+int main(int argc, char *argv[]) {
+    const int max_readers = argc > 1 ? std::atoi(argv[1]) : 64;
+    std::cout << "million lookups/s, one writer adding every 1ms\n"
+              << "readers\tstd::mutex\tstd::shared_mutex\trcu_protected"
+              << std::endl;
+    for (int readers = 1; readers <= max_readers; readers *= 2) {
+        std::cout << readers << '\t' << lookup_rate<mutex_list>(readers)
+                  << "\t\t" << lookup_rate<shared_mutex_list>(readers)
+                  << "\t\t\t" << lookup_rate<rcu_list>(readers) << std::endl;
+    }
+}
@@ -0,0 +1,394 @@
+// A mutex wrapper that profiles contention
+//
+// profiled_mutex<Mutex> wraps any lockable and can be used with
+// std::lock_guard, std::unique_lock and std::condition_variable_any. For
+// every acquisition it measures how long the thread waited and how long it
+// held the lock, and whether the lock was contended (the first try_lock
+// failed).
+//
+// Samples go into statistics owned by the recording thread, so recording
+// takes no lock and writes no shared cache line. `lock_profile::report()`
+// merges them on demand, per lock and sorted by total wait time; for
+// hierarchical mutexes it also groups them by hierarchy value.
+//
+// Locks that are members of other classes, like the ones in threadsafe_stack
+// and threadsafe_queue, are default-constructed; they take their name from
+// the innermost lock_profile::naming_scope of the constructing thread.
+#ifndef PROFILED_MUTEX_HPP
+#define PROFILED_MUTEX_HPP
+
+#include "listing_3_8.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lock_profile {
+
+using clock = std::chrono::steady_clock;
+
+// bucket i counts durations in [2^(i-1), 2^i) nanoseconds
+constexpr int histogram_buckets = 40;
+
+inline int histogram_bucket(std::uint64_t ns) {
+    int i = 0;
+    while (ns != 0 && i < histogram_buckets - 1) {
+        ns >>= 1;
+        ++i;
+    }
+    return i;
+}
+
+struct histogram {
+    std::uint64_t buckets[histogram_buckets] = {};
+};
+
+// Statistics of one lock as seen by one thread. Only that thread writes
+// them; readers get a consistent-enough view through relaxed atomics.
+class thread_lock_stats {
+private:
+    template <typename T> static void add(std::atomic<T> &a, T v) {
+        a.store(a.load(std::memory_order_relaxed) + v,
+                std::memory_order_relaxed);
+    }
+
+    template <typename T> static void raise(std::atomic<T> &a, T v) {
+        if (v > a.load(std::memory_order_relaxed)) {
+            a.store(v, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    std::atomic<std::uint64_t> acquisitions{0};
+    std::atomic<std::uint64_t> contended{0};
+    std::atomic<std::uint64_t> total_wait_ns{0};
+    std::atomic<std::uint64_t> max_wait_ns{0};
+    std::atomic<std::uint64_t> total_hold_ns{0};
+    std::atomic<std::uint64_t> max_hold_ns{0};
+    std::atomic<std::uint64_t> wait_histogram[histogram_buckets] = {};
+    std::atomic<std::uint64_t> hold_histogram[histogram_buckets] = {};
+
+    void record(std::uint64_t wait_ns, std::uint64_t hold_ns,
+                bool was_contended) {
+        add<std::uint64_t>(acquisitions, 1);
+        add<std::uint64_t>(contended, was_contended ? 1 : 0);
+        add(total_wait_ns, wait_ns);
+        raise(max_wait_ns, wait_ns);
+        add(total_hold_ns, hold_ns);
+        raise(max_hold_ns, hold_ns);
+        add<std::uint64_t>(wait_histogram[histogram_bucket(wait_ns)], 1);
+        add<std::uint64_t>(hold_histogram[histogram_bucket(hold_ns)], 1);
+    }
+};
+
+struct lock_info {
+    std::string name;
+    bool has_hierarchy_value;
+    unsigned long hierarchy_value;
+};
+
+// The statistics of one thread, kept alive after the thread exits.
+struct thread_buffer {
+    std::thread::id owner;
+    // guards insertions into `stats`; the owning thread looks entries up
+    // without it, as nobody else modifies the map
+    std::mutex mtx;
+    std::unordered_map<std::uint64_t, std::unique_ptr<thread_lock_stats>> stats;
+
+    thread_lock_stats &stats_for(std::uint64_t lock_id) {
+        auto it = stats.find(lock_id);
+        if (it != stats.end()) {
+            return *it->second;
+        }
+        std::lock_guard<std::mutex> lk(mtx);
+        return *stats.emplace(lock_id, std::make_unique<thread_lock_stats>())
+                    .first->second;
+    }
+};
+
+struct registry {
+    std::mutex mtx;
+    std::vector<std::shared_ptr<thread_buffer>> buffers;
+    std::map<std::uint64_t, lock_info> locks;
+    std::uint64_t next_id = 1;
+
+    std::uint64_t register_lock(lock_info info) {
+        std::lock_guard<std::mutex> lk(mtx);
+        locks.emplace(next_id, std::move(info));
+        return next_id++;
+    }
+
+    std::shared_ptr<thread_buffer> new_thread_buffer() {
+        auto buffer = std::make_shared<thread_buffer>();
+        buffer->owner = std::this_thread::get_id();
+        std::lock_guard<std::mutex> lk(mtx);
+        buffers.push_back(buffer);
+        return buffer;
+    }
+};
+
+inline registry &global_registry() {
+    static registry r;
+    return r;
+}
+
+inline thread_local const char *current_name = nullptr;
+
+// Names the profiled mutexes default-constructed by this thread while the
+// scope lives.
+class naming_scope {
+private:
+    const char *previous;
+
+public:
+    explicit naming_scope(const char *name) : previous(current_name) {
+        current_name = name;
+    }
+
+    naming_scope(const naming_scope &) = delete;
+    naming_scope &operator=(const naming_scope &) = delete;
+
+    ~naming_scope() { current_name = previous; }
+};
+
+inline thread_buffer &this_thread_buffer() {
+    thread_local std::shared_ptr<thread_buffer> buffer =
+        global_registry().new_thread_buffer();
+    return *buffer;
+}
+
+// Extracts the hierarchy value from the constructor arguments of
+// hierarchical mutexes; other mutexes have none.
+template <typename Mutex> struct hierarchy_value_of {
+    template <typename... Args>
+    static bool get(unsigned long &, const Args &...) {
+        return false;
+    }
+};
+
+template <typename Policy>
+struct hierarchy_value_of<basic_hierarchical_mutex<Policy>> {
+    static bool get(unsigned long &value, unsigned long v) {
+        value = v;
+        return true;
+    }
+};
+
+struct lock_report {
+    std::string name;
+    bool has_hierarchy_value;
+    unsigned long hierarchy_value;
+    std::uint64_t acquisitions = 0;
+    std::uint64_t contended = 0;
+    std::uint64_t total_wait_ns = 0;
+    std::uint64_t max_wait_ns = 0;
+    std::uint64_t total_hold_ns = 0;
+    std::uint64_t max_hold_ns = 0;
+    histogram wait_histogram;
+    histogram hold_histogram;
+    // the thread that held the lock longest in total
+    std::thread::id top_owner;
+    std::uint64_t top_owner_hold_ns = 0;
+};
+
+// One entry per lock, the lock with the most total wait time first.
+inline std::vector<lock_report> report() {
+    registry &r = global_registry();
+    std::lock_guard<std::mutex> lk(r.mtx);
+    std::map<std::uint64_t, lock_report> merged;
+    for (const auto &buffer : r.buffers) {
+        std::lock_guard<std::mutex> buffer_lk(buffer->mtx);
+        for (const auto &entry : buffer->stats) {
+            const lock_info &info = r.locks.at(entry.first);
+            const thread_lock_stats &s = *entry.second;
+            lock_report &rep = merged[entry.first];
+            rep.name = info.name;
+            rep.has_hierarchy_value = info.has_hierarchy_value;
+            rep.hierarchy_value = info.hierarchy_value;
+            rep.acquisitions += s.acquisitions.load(std::memory_order_relaxed);
+            rep.contended += s.contended.load(std::memory_order_relaxed);
+            rep.total_wait_ns += s.total_wait_ns.load(std::memory_order_relaxed);
+            rep.max_wait_ns = std::max<std::uint64_t>(
+                rep.max_wait_ns, s.max_wait_ns.load(std::memory_order_relaxed));
+            const std::uint64_t hold =
+                s.total_hold_ns.load(std::memory_order_relaxed);
+            rep.total_hold_ns += hold;
+            rep.max_hold_ns = std::max<std::uint64_t>(
+                rep.max_hold_ns, s.max_hold_ns.load(std::memory_order_relaxed));
+            for (int i = 0; i < histogram_buckets; ++i) {
+                rep.wait_histogram.buckets[i] +=
+                    s.wait_histogram[i].load(std::memory_order_relaxed);
+                rep.hold_histogram.buckets[i] +=
+                    s.hold_histogram[i].load(std::memory_order_relaxed);
+            }
+            if (hold >= rep.top_owner_hold_ns) {
+                rep.top_owner = buffer->owner;
+                rep.top_owner_hold_ns = hold;
+            }
+        }
+    }
+    std::vector<lock_report> res;
+    for (auto &entry : merged) {
+        res.push_back(std::move(entry.second));
+    }
+    std::sort(res.begin(), res.end(),
+              [](const lock_report &a, const lock_report &b) {
+                  return a.total_wait_ns > b.total_wait_ns;
+              });
+    return res;
+}
+
+inline void print_histogram(std::ostream &os, const histogram &h) {
+    for (int i = 0; i < histogram_buckets; ++i) {
+        if (h.buckets[i]) {
+            os << " <" << (std::uint64_t(1) << i) << "ns:" << h.buckets[i];
+        }
+    }
+}
+
+inline void print_report(std::ostream &os) {
+    const std::vector<lock_report> locks = report();
+    os << "locks by total wait time\n";
+    for (const auto &rep : locks) {
+        os << "  " << rep.name;
+        if (rep.has_hierarchy_value) {
+            os << " (hierarchy value " << rep.hierarchy_value << ")";
+        }
+        os << ": " << rep.acquisitions << " acquisitions, " << rep.contended
+           << " contended, wait total/max " << rep.total_wait_ns / 1000
+           << "us/" << rep.max_wait_ns / 1000 << "us, hold total/max "
+           << rep.total_hold_ns / 1000 << "us/" << rep.max_hold_ns / 1000
+           << "us, longest holder thread " << rep.top_owner << "\n"
+           << "    wait:";
+        print_histogram(os, rep.wait_histogram);
+        os << "\n    hold:";
+        print_histogram(os, rep.hold_histogram);
+        os << "\n";
+    }
+
+    std::map<unsigned long, lock_report> by_value;
+    for (const auto &rep : locks) {
+        if (!rep.has_hierarchy_value) {
+            continue;
+        }
+        lock_report &sum = by_value[rep.hierarchy_value];
+        sum.acquisitions += rep.acquisitions;
+        sum.contended += rep.contended;
+        sum.total_wait_ns += rep.total_wait_ns;
+        sum.total_hold_ns += rep.total_hold_ns;
+    }
+    if (by_value.empty()) {
+        return;
+    }
+    std::vector<std::pair<unsigned long, lock_report>> sorted(by_value.begin(),
+                                                              by_value.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+        return a.second.total_wait_ns > b.second.total_wait_ns;
+    });
+    os << "hierarchical mutexes by hierarchy value\n";
+    for (const auto &entry : sorted) {
+        os << "  " << std::setw(10) << entry.first << ": "
+           << entry.second.acquisitions << " acquisitions, "
+           << entry.second.contended << " contended, wait total "
+           << entry.second.total_wait_ns / 1000 << "us, hold total "
+           << entry.second.total_hold_ns / 1000 << "us\n";
+    }
+}
+
+} // namespace lock_profile
+
+template <typename Mutex = std::mutex> class profiled_mutex {
+private:
+    Mutex internal_mutex;
+    const std::uint64_t id;
+    std::atomic<std::thread::id> owner_thread;
+    // only touched by the owner while it holds the lock
+    lock_profile::clock::time_point locked_at;
+    std::uint64_t wait_ns;
+    bool was_contended;
+
+    template <typename... Args>
+    static lock_profile::lock_info make_info(std::string name,
+                                             const Args &...args) {
+        lock_profile::lock_info info{std::move(name), false, 0};
+        info.has_hierarchy_value =
+            lock_profile::hierarchy_value_of<Mutex>::get(info.hierarchy_value,
+                                                         args...);
+        return info;
+    }
+
+    void acquired(lock_profile::clock::time_point start, bool contended) {
+        locked_at = lock_profile::clock::now();
+        wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      locked_at - start)
+                      .count();
+        was_contended = contended;
+        owner_thread.store(std::this_thread::get_id(),
+                           std::memory_order_relaxed);
+    }
+
+public:
+    profiled_mutex()
+        : profiled_mutex(lock_profile::current_name ? lock_profile::current_name
+                                                    : "unnamed") {}
+
+    // `name` identifies the lock in the report, `args` go to Mutex.
+    template <typename... Args>
+    explicit profiled_mutex(std::string name, Args &&...args)
+        : internal_mutex(std::forward<Args>(args)...),
+          id(lock_profile::global_registry().register_lock(
+              make_info(std::move(name), args...))),
+          wait_ns(0), was_contended(false) {}
+
+    profiled_mutex(const profiled_mutex &) = delete;
+    profiled_mutex &operator=(const profiled_mutex &) = delete;
+
+    void lock() {
+        const auto start = lock_profile::clock::now();
+        if (internal_mutex.try_lock()) {
+            acquired(start, false);
+            return;
+        }
+        internal_mutex.lock();
+        acquired(start, true);
+    }
+
+    bool try_lock() {
+        const auto start = lock_profile::clock::now();
+        if (!internal_mutex.try_lock()) {
+            return false;
+        }
+        acquired(start, false);
+        return true;
+    }
+
+    void unlock() {
+        const std::uint64_t hold_ns =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                lock_profile::clock::now() - locked_at)
+                .count();
+        const std::uint64_t wait = wait_ns;
+        const bool contended = was_contended;
+        owner_thread.store(std::thread::id(), std::memory_order_relaxed);
+        internal_mutex.unlock();
+        lock_profile::this_thread_buffer().stats_for(id).record(wait, hold_ns,
+                                                               contended);
+    }
+
+    // The thread holding the lock right now, if any.
+    std::thread::id owner() const {
+        return owner_thread.load(std::memory_order_relaxed);
+    }
+};
+
+#endif // end of PROFILED_MUTEX_HPP
@@ -0,0 +1,91 @@
+// Which lock is hurting us? Profiling the locks of a small program
+//
+// A producer/consumer pipeline over threadsafe_queue, a threadsafe_stack of
+// free buffers, and a pair of hierarchical mutexes all run on
+// profiled_mutex (demo_3_14.hpp). At the end the program prints every lock
+// sorted by total wait time, then the hierarchical mutexes grouped by
+// hierarchy value.
+#include "../ch04_synchronizing_concurrent_operations/listing_4_5.hpp"
+#include "demo_3_14.hpp"
+#include "listing_3_5.h"
+#include "listing_3_8.h"
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using profiled_hierarchical_mutex = profiled_mutex<hierarchical_mutex>;
+
+profiled_hierarchical_mutex high_level_mutex("high_level_mutex", 10000);
+profiled_hierarchical_mutex low_level_mutex("low_level_mutex", 5000);
+profiled_hierarchical_mutex other_low_level_mutex("other_low_level_mutex",
+                                                  5000);
+
+// holds the high level lock for a while, so callers queue up behind it
+void do_high_level_stuff() {
+    std::lock_guard<profiled_hierarchical_mutex> lk(high_level_mutex);
+    std::lock_guard<profiled_hierarchical_mutex> lk2(low_level_mutex);
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+void do_low_level_stuff() {
+    std::lock_guard<profiled_hierarchical_mutex> lk(other_low_level_mutex);
+}
+
+int main() {
+    const int producers = 4, consumers = 4, items = 20000;
+
+    std::unique_ptr<threadsafe_queue<int, std::allocator<int>,
+                                     profiled_mutex<>>>
+        work;
+    std::unique_ptr<threadsafe_stack<int, std::allocator<int>,
+                                     profiled_mutex<>>>
+        free_buffers;
+    {
+        lock_profile::naming_scope name("work queue");
+        work = std::make_unique<threadsafe_queue<int, std::allocator<int>,
+                                                 profiled_mutex<>>>();
+    }
+    {
+        lock_profile::naming_scope name("free buffers");
+        free_buffers = std::make_unique<
+            threadsafe_stack<int, std::allocator<int>, profiled_mutex<>>>();
+    }
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < items; ++i) {
+                int buffer;
+                if (!free_buffers->try_pop(buffer)) {
+                    buffer = i;
+                }
+                work->push(buffer);
+            }
+        });
+    }
+    for (int c = 0; c < consumers; ++c) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < items; ++i) {
+                int buffer;
+                work->wait_and_pop(buffer);
+                free_buffers->push(buffer);
+            }
+        });
+    }
+    for (int h = 0; h < 4; ++h) {
+        threads.emplace_back([] {
+            for (int i = 0; i < 200; ++i) {
+                do_high_level_stuff();
+                do_low_level_stuff();
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    lock_profile::print_report(std::cout);
+}
@@ -0,0 +1,126 @@
+// A spin-then-park mutex for very short critical sections
+//
+// adaptive_mutex is a drop-in for std::mutex (it is Lockable and standard
+// layout) built on one 32-bit word: 0 unlocked, 1 locked, 2 locked and
+// maybe somebody asleep. A contended lock() first spins, hoping the holder
+// leaves soon, then sleeps on a futex. unlock() only makes a system call
+// when the word says somebody may be asleep.
+//
+// How long to spin is learned. Every acquisition by spinning tells how many
+// rounds the holder still needed, i.e. how long it held the lock; the
+// budget follows a moving average of that, with headroom, and shrinks when
+// spinning did not pay off. Locks held for tens of nanoseconds, like the
+// ones in threadsafe_queue and threadsafe_stack, thus almost never sleep,
+// while locks held for long stop burning CPU quickly.
+#ifndef ADAPTIVE_MUTEX_HPP
+#define ADAPTIVE_MUTEX_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <thread>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class adaptive_mutex {
+private:
+    static constexpr int min_spins = 16;
+    static constexpr int max_spins = 2048;
+
+    enum : std::uint32_t { unlocked = 0, locked = 1, sleepers = 2 };
+
+    std::atomic<std::uint32_t> state;
+    // moving average of the spin rounds recent acquisitions needed, in 1/8
+    std::atomic<int> spin_estimate;
+
+    static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t),
+                  "futex word must be a plain 32-bit integer");
+
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    void park() {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&state),
+                FUTEX_WAIT_PRIVATE, sleepers, nullptr, nullptr, 0);
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+    void wake_one() {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&state),
+                FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+    }
+
+    // the estimate is only a hint, races between updates don't matter
+    void learn(int spins) {
+        const int estimate = spin_estimate.load(std::memory_order_relaxed);
+        spin_estimate.store(estimate + spins - estimate / 8,
+                            std::memory_order_relaxed);
+    }
+
+    void lock_contended() {
+        const int estimate = spin_estimate.load(std::memory_order_relaxed) / 8;
+        const int budget = std::min(max_spins, 2 * estimate + min_spins);
+        for (int i = 0; i < budget; ++i) {
+            cpu_relax();
+            std::uint32_t expected = unlocked;
+            if (state.load(std::memory_order_relaxed) == unlocked &&
+                state.compare_exchange_weak(expected, locked,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+                learn(i);
+                return;
+            }
+        }
+        // spinning did not pay off this time, spin less next time
+        learn(estimate / 2);
+
+        // from now on we don't know whether others sleep, so we leave
+        // `sleepers` behind for unlock() to wake them
+        while (state.exchange(sleepers, std::memory_order_acquire) !=
+               unlocked) {
+            park();
+        }
+    }
+
+public:
+    adaptive_mutex() noexcept : state(unlocked), spin_estimate(0) {}
+
+    adaptive_mutex(const adaptive_mutex &) = delete;
+    adaptive_mutex &operator=(const adaptive_mutex &) = delete;
+
+    void lock() {
+        std::uint32_t expected = unlocked;
+        if (!state.compare_exchange_strong(expected, locked,
+                                           std::memory_order_acquire,
+                                           std::memory_order_relaxed)) {
+            lock_contended();
+        }
+    }
+
+    bool try_lock() {
+        std::uint32_t expected = unlocked;
+        return state.compare_exchange_strong(expected, locked,
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed);
+    }
+
+    void unlock() {
+        if (state.exchange(unlocked, std::memory_order_release) == sleepers) {
+            wake_one();
+        }
+    }
+};
+
+#endif // end of ADAPTIVE_MUTEX_HPP
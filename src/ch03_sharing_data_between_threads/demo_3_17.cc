@@ -0,0 +1,84 @@
+// Operation latency of threadsafe_queue and threadsafe_stack: std::mutex vs.
+// adaptive_mutex
+//
+// usage: demo_3_17 [threads] [operations per thread]
+// Every thread alternates push and try_pop on one shared container and
+// times each call. Reported are latency percentiles over all calls, in ns.
+#include "../ch04_synchronizing_concurrent_operations/listing_4_5.hpp"
+#include "demo_3_16.hpp"
+#include "listing_3_5.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+template <typename Container>
+std::vector<std::uint64_t> latencies(int threads, int ops) {
+    Container container;
+    std::vector<std::vector<std::uint64_t>> samples(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            auto &mine = samples[t];
+            mine.reserve(ops);
+            int value;
+            for (int i = 0; i < ops; ++i) {
+                const auto start = std::chrono::steady_clock::now();
+                if (i % 2 == 0) {
+                    container.push(i);
+                } else {
+                    container.try_pop(value);
+                }
+                mine.push_back(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count());
+            }
+        });
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+    std::vector<std::uint64_t> all;
+    for (auto &s : samples) {
+        all.insert(all.end(), s.begin(), s.end());
+    }
+    std::sort(all.begin(), all.end());
+    return all;
+}
+
+void print_row(const std::string &name, const std::vector<std::uint64_t> &v) {
+    auto at = [&](double p) {
+        return v[std::min(v.size() - 1, static_cast<std::size_t>(p * v.size()))];
+    };
+    std::cout << name << '\t' << at(0.5) << '\t' << at(0.9) << '\t'
+              << at(0.99) << '\t' << at(0.999) << '\t' << v.back()
+              << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    const int threads =
+        argc > 1 ? std::atoi(argv[1])
+                 : std::max(2u, std::thread::hardware_concurrency());
+    const int ops = argc > 2 ? std::atoi(argv[2]) : 200'000;
+
+    using alloc = std::allocator<int>;
+    std::cout << threads << " threads, " << ops << " operations each\n"
+              << "container\t\t\tp50\tp90\tp99\tp99.9\tmax" << std::endl;
+    print_row("queue, std::mutex\t",
+              latencies<threadsafe_queue<int, alloc, std::mutex>>(threads, ops));
+    print_row("queue, adaptive_mutex\t",
+              latencies<threadsafe_queue<int, alloc, adaptive_mutex>>(threads,
+                                                                      ops));
+    print_row("stack, std::mutex\t",
+              latencies<threadsafe_stack<int, alloc, std::mutex>>(threads, ops));
+    print_row("stack, adaptive_mutex\t",
+              latencies<threadsafe_stack<int, alloc, adaptive_mutex>>(threads,
+                                                                      ops));
+}
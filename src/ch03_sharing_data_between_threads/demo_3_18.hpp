@@ -0,0 +1,168 @@
+// Locking many mutexes at once without deadlock and without retries
+//
+// std::lock (used by Listing 3.6's swap) avoids deadlock by locking one
+// mutex, trying the others and backing off whenever one is taken. With
+// dozens of mutexes and some contention it keeps backing off and starts
+// over. lock_set instead sorts its mutexes into one global order, their
+// addresses, and locks them in that order: any two lock_sets then agree on
+// which of their common mutexes comes first, so neither can wait for the
+// other in a cycle, and a blocking lock() never has to let go of anything.
+//
+// try_lock_for()/try_lock_until() lock in the same order but give up at a
+// deadline, releasing what they already hold; `retries()` tells how many
+// times the last acquisition found a mutex taken and tried again.
+//
+// A lock_set is BasicLockable and Lockable itself, so std::unique_lock and
+// std::lock_guard can manage it.
+#ifndef LOCK_SET_HPP
+#define LOCK_SET_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template <typename Mutex = std::mutex> class lock_set {
+private:
+    std::vector<Mutex *> mutexes;
+    // number of mutexes, in order, currently held by this set
+    std::size_t held = 0;
+    std::size_t last_retries = 0;
+
+    template <typename M, typename = void>
+    struct is_timed : std::false_type {};
+
+    template <typename M>
+    struct is_timed<M, std::void_t<decltype(std::declval<M &>().try_lock_until(
+                           std::chrono::steady_clock::now()))>>
+        : std::true_type {};
+
+    static Mutex *address(Mutex &m) { return &m; }
+    static Mutex *address(Mutex *m) { return m; }
+
+    void normalize() {
+        std::sort(mutexes.begin(), mutexes.end(), std::less<Mutex *>());
+        mutexes.erase(std::unique(mutexes.begin(), mutexes.end()),
+                      mutexes.end());
+    }
+
+    void release_held() {
+        while (held != 0) {
+            mutexes[--held]->unlock();
+        }
+    }
+
+    template <typename Clock, typename Duration>
+    bool lock_one_until(Mutex &m,
+                        const std::chrono::time_point<Clock, Duration> &deadline) {
+        if (m.try_lock()) {
+            return true;
+        }
+        if constexpr (is_timed<Mutex>::value) {
+            ++last_retries;
+            return m.try_lock_until(deadline);
+        } else {
+            for (;;) {
+                ++last_retries;
+                if (Clock::now() >= deadline) {
+                    return false;
+                }
+                std::this_thread::yield();
+                if (m.try_lock()) {
+                    return true;
+                }
+            }
+        }
+    }
+
+public:
+    lock_set() = default;
+
+    lock_set(std::initializer_list<std::reference_wrapper<Mutex>> ms) {
+        for (Mutex &m : ms) {
+            mutexes.push_back(&m);
+        }
+        normalize();
+    }
+
+    // `first`..`last` are Mutex* or references to Mutex.
+    template <typename It> lock_set(It first, It last) {
+        for (; first != last; ++first) {
+            mutexes.push_back(address(*first));
+        }
+        normalize();
+    }
+
+    lock_set(const lock_set &) = delete;
+    lock_set &operator=(const lock_set &) = delete;
+
+    ~lock_set() { release_held(); }
+
+    // Adding is only allowed while nothing is held.
+    void add(Mutex &m) {
+        mutexes.push_back(&m);
+        normalize();
+    }
+
+    // Distinct mutexes in the set.
+    std::size_t size() const { return mutexes.size(); }
+
+    // Blocks until all mutexes are held; never backs off.
+    void lock() {
+        last_retries = 0;
+        try {
+            for (; held < mutexes.size(); ++held) {
+                mutexes[held]->lock();
+            }
+        } catch (...) {
+            release_held();
+            throw;
+        }
+    }
+
+    bool try_lock() {
+        last_retries = 0;
+        for (; held < mutexes.size(); ++held) {
+            if (!mutexes[held]->try_lock()) {
+                release_held();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <typename Clock, typename Duration>
+    bool try_lock_until(const std::chrono::time_point<Clock, Duration> &deadline) {
+        last_retries = 0;
+        try {
+            for (; held < mutexes.size(); ++held) {
+                if (!lock_one_until(*mutexes[held], deadline)) {
+                    release_held();
+                    return false;
+                }
+            }
+        } catch (...) {
+            release_held();
+            throw;
+        }
+        return true;
+    }
+
+    template <typename Rep, typename Period>
+    bool try_lock_for(const std::chrono::duration<Rep, Period> &timeout) {
+        return try_lock_until(std::chrono::steady_clock::now() + timeout);
+    }
+
+    void unlock() { release_held(); }
+
+    // Failed attempts during the last lock, try_lock or try_lock_until.
+    std::size_t retries() const { return last_retries; }
+};
+
+#endif // end of LOCK_SET_HPP
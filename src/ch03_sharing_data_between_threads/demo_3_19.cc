@@ -0,0 +1,149 @@
+// Multi-account transfers: variadic std::lock vs. lock_set
+//
+// usage: demo_3_19 [threads] [accounts]
+// Every transfer picks K distinct accounts at random, locks all of them and
+// moves one unit from the first account to each of the others. Reported
+// are thousand transfers per second for std::lock, lock_set::lock and
+// lock_set::try_lock_for (with the average number of retries per transfer),
+// and whether the total balance was preserved.
+#include "demo_3_18.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct account {
+    std::mutex mtx;
+    long balance = 1000;
+};
+
+template <std::size_t K>
+void pick_accounts(std::vector<account> &accounts, std::mt19937 &gen,
+                   std::array<account *, K> &picked) {
+    std::uniform_int_distribution<std::size_t> dist(0, accounts.size() - 1);
+    for (std::size_t i = 0; i < K; ++i) {
+        account *a;
+        do {
+            a = &accounts[dist(gen)];
+        } while (std::find(picked.begin(), picked.begin() + i, a) !=
+                 picked.begin() + i);
+        picked[i] = a;
+    }
+}
+
+template <std::size_t K> void move_money(std::array<account *, K> &picked) {
+    for (std::size_t i = 1; i < K; ++i) {
+        --picked[0]->balance;
+        ++picked[i]->balance;
+    }
+}
+
+template <std::size_t K, std::size_t... I>
+void std_lock_all(std::array<account *, K> &picked, std::index_sequence<I...>) {
+    std::lock(picked[I]->mtx...);
+}
+
+enum class method { std_lock, lock_set_lock, lock_set_try_lock_for };
+
+struct result {
+    double transfers_per_ms;
+    double retries_per_transfer;
+    bool balance_preserved;
+};
+
+template <std::size_t K>
+result run(method how, int threads, std::size_t account_count) {
+    std::vector<account> accounts(account_count);
+    std::atomic<bool> done(false);
+    std::atomic<long> transfers(0), retries(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937 gen(t);
+            std::array<account *, K> picked;
+            long n = 0, r = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                pick_accounts(accounts, gen, picked);
+                if (how == method::std_lock) {
+                    std_lock_all(picked, std::make_index_sequence<K>());
+                    move_money(picked);
+                    for (account *a : picked) {
+                        a->mtx.unlock();
+                    }
+                } else {
+                    std::array<std::mutex *, K> mutexes;
+                    for (std::size_t i = 0; i < K; ++i) {
+                        mutexes[i] = &picked[i]->mtx;
+                    }
+                    lock_set<std::mutex> locks(mutexes.begin(), mutexes.end());
+                    if (how == method::lock_set_lock) {
+                        locks.lock();
+                    } else {
+                        while (!locks.try_lock_for(std::chrono::milliseconds(1))) {
+                            r += locks.retries();
+                        }
+                        r += locks.retries();
+                    }
+                    move_money(picked);
+                    locks.unlock();
+                }
+                ++n;
+            }
+            transfers += n;
+            retries += r;
+        });
+    }
+    const auto duration = std::chrono::milliseconds(300);
+    std::this_thread::sleep_for(duration);
+    done = true;
+    for (auto &w : workers) {
+        w.join();
+    }
+    long total = 0;
+    for (auto &a : accounts) {
+        total += a.balance;
+    }
+    return {transfers / double(duration.count()),
+            transfers ? retries / double(transfers) : 0,
+            total == 1000L * long(account_count)};
+}
+
+template <std::size_t K> void print_row(int threads, std::size_t accounts) {
+    const result std_lock = run<K>(method::std_lock, threads, accounts);
+    const result sorted = run<K>(method::lock_set_lock, threads, accounts);
+    const result timed = run<K>(method::lock_set_try_lock_for, threads, accounts);
+    std::cout << std::setw(3) << K << std::setw(12) << std_lock.transfers_per_ms
+              << std::setw(16) << sorted.transfers_per_ms << std::setw(22)
+              << timed.transfers_per_ms << std::setw(10)
+              << timed.retries_per_transfer << std::setw(10)
+              << (std_lock.balance_preserved && sorted.balance_preserved &&
+                  timed.balance_preserved)
+              << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    const int threads =
+        argc > 1 ? std::atoi(argv[1])
+                 : std::max(4u, std::thread::hardware_concurrency());
+    const std::size_t accounts = argc > 2 ? std::atoi(argv[2]) : 256;
+    std::cout << threads << " threads, " << accounts
+              << " accounts, thousand transfers/s\n"
+              << "  K   std::lock  lock_set::lock  lock_set::try_lock_for"
+                 "   retries  balanced"
+              << std::boolalpha << std::fixed << std::setprecision(2)
+              << std::endl;
+    print_row<3>(threads, accounts);
+    print_row<8>(threads, accounts);
+    print_row<16>(threads, accounts);
+    print_row<32>(threads, accounts);
+    print_row<50>(threads, accounts);
+}
@@ -0,0 +1,150 @@
+// Hazard pointers for safe memory reclamation in lock-free data structures
+//
+// Before dereferencing a node that other threads may delete, a thread
+// publishes its address in its hazard pointer. A node that has been unlinked
+// is not deleted right away but handed to `reclaim_later()`; once enough
+// nodes have been retired, the thread deletes those that no hazard pointer
+// refers to. Nodes still retired when a thread exits are handed over to the
+// next thread that scans, so nothing leaks.
+#ifndef HAZARD_POINTERS_HPP
+#define HAZARD_POINTERS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace hazard_pointers {
+
+constexpr unsigned max_hazard_pointers = 128;
+// a thread scans its retired nodes once it has this many
+constexpr unsigned reclaim_threshold = 2 * max_hazard_pointers;
+
+struct hazard_pointer {
+    std::atomic<std::thread::id> id;
+    std::atomic<void *> pointer;
+};
+
+inline hazard_pointer hazard_pointer_table[max_hazard_pointers];
+
+struct retired_node {
+    void *pointer;
+    void (*deleter)(void *);
+};
+
+// nodes left behind by threads that have exited
+inline std::mutex orphans_mtx;
+inline std::vector<retired_node> orphans;
+inline std::atomic<bool> has_orphans(false);
+
+inline void delete_nodes_with_no_hazards(std::vector<retired_node> &nodes) {
+    if (has_orphans.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lk(orphans_mtx);
+        nodes.insert(nodes.end(), orphans.begin(), orphans.end());
+        orphans.clear();
+        has_orphans.store(false, std::memory_order_relaxed);
+    }
+
+    std::vector<void *> hazards;
+    hazards.reserve(max_hazard_pointers);
+    for (const auto &hp : hazard_pointer_table) {
+        if (void *p = hp.pointer.load()) {
+            hazards.push_back(p);
+        }
+    }
+    std::sort(hazards.begin(), hazards.end());
+
+    auto still_hazardous = std::partition(
+        nodes.begin(), nodes.end(), [&](const retired_node &node) {
+            return std::binary_search(hazards.begin(), hazards.end(),
+                                      node.pointer);
+        });
+    for (auto it = still_hazardous; it != nodes.end(); ++it) {
+        it->deleter(it->pointer);
+    }
+    nodes.erase(still_hazardous, nodes.end());
+}
+
+// Per-thread state: the hazard pointer slot owned by this thread and the
+// nodes it has retired.
+class thread_record {
+private:
+    hazard_pointer *hp;
+
+public:
+    std::vector<retired_node> retired;
+
+    thread_record() : hp(nullptr) {
+        for (auto &slot : hazard_pointer_table) {
+            std::thread::id old_id;
+            if (slot.id.compare_exchange_strong(old_id,
+                                                std::this_thread::get_id())) {
+                hp = &slot;
+                break;
+            }
+        }
+        if (!hp) {
+            throw std::runtime_error("no hazard pointers available");
+        }
+        retired.reserve(reclaim_threshold);
+    }
+
+    thread_record(const thread_record &) = delete;
+    thread_record &operator=(const thread_record &) = delete;
+
+    ~thread_record() {
+        hp->pointer.store(nullptr);
+        hp->id.store(std::thread::id());
+        delete_nodes_with_no_hazards(retired);
+        if (!retired.empty()) {
+            std::lock_guard<std::mutex> lk(orphans_mtx);
+            orphans.insert(orphans.end(), retired.begin(), retired.end());
+            has_orphans.store(true, std::memory_order_release);
+        }
+    }
+
+    std::atomic<void *> &pointer() { return hp->pointer; }
+};
+
+inline thread_record &this_thread_record() {
+    thread_local thread_record record;
+    return record;
+}
+
+inline std::atomic<void *> &get_hazard_pointer_for_current_thread() {
+    return this_thread_record().pointer();
+}
+
+template <typename T> void reclaim_later(T *p) {
+    std::vector<retired_node> &retired = this_thread_record().retired;
+    retired.push_back({p, [](void *q) { delete static_cast<T *>(q); }});
+    if (retired.size() >= reclaim_threshold) {
+        delete_nodes_with_no_hazards(retired);
+    }
+}
+
+// Deletes every retired node of this thread, and of threads that have exited,
+// that is no longer protected.
+inline void reclaim_retired_nodes() {
+    delete_nodes_with_no_hazards(this_thread_record().retired);
+}
+
+// Frees what is left at program exit, when no thread can hold a hazard.
+struct orphan_cleanup {
+    ~orphan_cleanup() {
+        std::lock_guard<std::mutex> lk(orphans_mtx);
+        for (auto &node : orphans) {
+            node.deleter(node.pointer);
+        }
+        orphans.clear();
+    }
+};
+
+inline orphan_cleanup cleanup_at_exit;
+
+} // namespace hazard_pointers
+
+#endif // end of HAZARD_POINTERS_HPP
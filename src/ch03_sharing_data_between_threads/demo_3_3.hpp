@@ -0,0 +1,94 @@
+// A lock-free stack (Treiber stack) using hazard pointers
+//
+// push and pop only CAS the head pointer. A popping thread protects the head
+// with its hazard pointer before reading `head->next`, so a node can't be
+// freed and reused underneath it (no ABA) and unlinked nodes are reclaimed
+// once nobody refers to them. An empty stack is reported through the return
+// value, not by throwing.
+#ifndef LOCK_FREE_STACK_HPP
+#define LOCK_FREE_STACK_HPP
+
+#include "demo_3_2.hpp"
+#include <atomic>
+#include <optional>
+#include <utility>
+
+template <typename T> class lock_free_stack {
+private:
+    struct node {
+        T data;
+        node *next;
+
+        node(T data_) : data(std::move(data_)), next(nullptr) {}
+    };
+
+    std::atomic<node *> head;
+
+    // Unlinks the head, or returns nullptr if the stack is empty. On return
+    // the caller owns the node exclusively but must retire it, other threads
+    // may still be reading it.
+    node *pop_head() {
+        std::atomic<void *> &hp =
+            hazard_pointers::get_hazard_pointer_for_current_thread();
+        node *old_head = head.load();
+        do {
+            node *temp;
+            do { // loop until the hazard pointer is known to be valid
+                temp = old_head;
+                hp.store(old_head);
+                old_head = head.load();
+            } while (old_head != temp);
+        } while (old_head &&
+                 !head.compare_exchange_strong(old_head, old_head->next));
+        hp.store(nullptr);
+        return old_head;
+    }
+
+public:
+    lock_free_stack() : head(nullptr) {}
+
+    lock_free_stack(const lock_free_stack &) = delete;
+    lock_free_stack &operator=(const lock_free_stack &) = delete;
+
+    ~lock_free_stack() {
+        node *p = head.load();
+        while (p) {
+            node *next = p->next;
+            delete p;
+            p = next;
+        }
+    }
+
+    void push(T new_value) {
+        node *const new_node = new node(std::move(new_value));
+        new_node->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(new_node->next, new_node,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+        }
+    }
+
+    std::optional<T> try_pop() {
+        node *old_head = pop_head();
+        if (!old_head) {
+            return std::nullopt;
+        }
+        std::optional<T> res(std::move(old_head->data));
+        hazard_pointers::reclaim_later(old_head);
+        return res;
+    }
+
+    bool try_pop(T &value) {
+        node *old_head = pop_head();
+        if (!old_head) {
+            return false;
+        }
+        value = std::move(old_head->data);
+        hazard_pointers::reclaim_later(old_head);
+        return true;
+    }
+
+    bool empty() const { return head.load() == nullptr; }
+};
+
+#endif // end of LOCK_FREE_STACK_HPP
@@ -0,0 +1,146 @@
+// Stress test of lock_free_stack and a contention benchmark against
+// threadsafe_stack (Listing 3.5)
+//
+// usage: demo_3_4 [max threads] [operations per thread]
+#include "listing_3_5.h"
+#include "demo_3_3.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using steady_clock = std::chrono::steady_clock;
+
+// counts live instances, to check that every node gets reclaimed
+struct tracked {
+    static std::atomic<long> live;
+    long value;
+
+    tracked(long v = 0) : value(v) { ++live; }
+    tracked(const tracked &other) : value(other.value) { ++live; }
+    tracked &operator=(const tracked &) = default;
+    ~tracked() { --live; }
+};
+
+std::atomic<long> tracked::live(0);
+
+bool stress_test(int threads, long per_thread) {
+    std::vector<std::atomic<int>> seen(threads * per_thread);
+    {
+        lock_free_stack<tracked> stack;
+        std::atomic<long> popped(0);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                for (long i = 0; i < per_thread; ++i) {
+                    stack.push(tracked(t * per_thread + i));
+                    if (i % 2 == 1) { // pop twice on every second push
+                        for (int k = 0; k < 2; ++k) {
+                            if (auto v = stack.try_pop()) {
+                                ++seen[v->value];
+                                ++popped;
+                            }
+                        }
+                    }
+                }
+            });
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        tracked v;
+        while (stack.try_pop(v)) {
+            ++seen[v.value];
+            ++popped;
+        }
+        if (popped != threads * per_thread) {
+            std::cout << "popped " << popped << " of "
+                      << threads * per_thread << std::endl;
+            return false;
+        }
+    }
+    if (std::any_of(seen.begin(), seen.end(),
+                    [](const std::atomic<int> &n) { return n != 1; })) {
+        std::cout << "a value was lost or popped twice" << std::endl;
+        return false;
+    }
+    hazard_pointers::reclaim_retired_nodes();
+    if (tracked::live != 0) {
+        std::cout << tracked::live << " nodes leaked" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+struct mutex_stack_adapter {
+    threadsafe_stack<long> stack;
+
+    void push(long v) { stack.push(v); }
+
+    bool try_pop(long &v) {
+        try {
+            stack.pop(v);
+            return true;
+        } catch (const empty_stack &) {
+            return false;
+        }
+    }
+};
+
+struct lock_free_stack_adapter {
+    lock_free_stack<long> stack;
+
+    void push(long v) { stack.push(v); }
+
+    bool try_pop(long &v) { return stack.try_pop(v); }
+};
+
+// Every thread alternates push and pop; returns million operations per
+// second.
+template <typename Stack> double throughput(int threads, long per_thread) {
+    Stack stack;
+    std::vector<std::thread> workers;
+    auto t_start = steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            long v;
+            for (long i = 0; i < per_thread; ++i) {
+                stack.push(i);
+                stack.try_pop(v);
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    auto elapse = std::chrono::duration_cast<std::chrono::microseconds>(
+        steady_clock::now() - t_start);
+    return 2.0 * threads * per_thread /
+           std::max<long long>(elapse.count(), 1);
+}
+
+int main(int argc, char *argv[]) {
+    const int max_threads =
+        argc > 1 ? std::atoi(argv[1])
+                 : std::max(2u, std::thread::hardware_concurrency());
+    const long per_thread = argc > 2 ? std::atol(argv[2]) : 200'000;
+
+    if (!stress_test(max_threads, per_thread)) {
+        std::cerr << "stress test: FAILED" << std::endl;
+        return 1;
+    }
+    std::cout << "stress test: passed" << std::endl;
+
+    std::cout << "Mops/s with alternating push/pop\n"
+              << "threads\tthreadsafe_stack\tlock_free_stack" << std::endl;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        std::cout << threads << '\t'
+                  << throughput<mutex_stack_adapter>(threads, per_thread)
+                  << "\t\t"
+                  << throughput<lock_free_stack_adapter>(threads, per_thread)
+                  << std::endl;
+    }
+}
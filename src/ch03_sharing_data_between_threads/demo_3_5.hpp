@@ -0,0 +1,229 @@
+// A lock-free stack with an elimination-backoff layer
+//
+// A push followed by a pop leaves the stack unchanged, so under a storm of
+// both the pair doesn't need to touch the head at all. When a CAS on the head
+// fails, a pushing thread parks its node in a randomly chosen slot of the
+// elimination array and waits a little; a popping thread whose CAS failed
+// looks for a parked node and takes it. Only when that doesn't work out do
+// they go back to the head.
+//
+// The number of slots in use adapts to the observed contention: it grows
+// when threads collide on an occupied slot and shrinks when a parked push
+// times out without a partner.
+#ifndef ELIMINATION_BACKOFF_STACK_HPP
+#define ELIMINATION_BACKOFF_STACK_HPP
+
+#include "demo_3_2.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <random>
+#include <thread>
+#include <utility>
+
+template <typename Node> class elimination_array {
+private:
+    static constexpr std::size_t cache_line_size = 64;
+    static constexpr unsigned capacity = 32;
+    // how long a push stays parked, and how many slots a pop inspects
+    static constexpr unsigned spin_limit = 128;
+
+    // a slot is empty, holds the node offered by a push, or `taken()` once a
+    // pop has claimed the node and the push hasn't noticed yet
+    struct alignas(cache_line_size) slot {
+        std::atomic<Node *> offer{nullptr};
+    };
+
+    slot slots[capacity];
+    std::atomic<unsigned> width;
+
+    static Node *taken() {
+        return reinterpret_cast<Node *>(std::uintptr_t(1));
+    }
+
+    static unsigned random_below(unsigned n) {
+        thread_local std::minstd_rand engine(static_cast<unsigned>(
+            std::hash<std::thread::id>()(std::this_thread::get_id())));
+        return std::uniform_int_distribution<unsigned>(0, n - 1)(engine);
+    }
+
+    void grow() {
+        unsigned w = width.load(std::memory_order_relaxed);
+        if (w < capacity) {
+            width.compare_exchange_weak(w, w + 1, std::memory_order_relaxed);
+        }
+    }
+
+    void shrink() {
+        unsigned w = width.load(std::memory_order_relaxed);
+        if (w > 1) {
+            width.compare_exchange_weak(w, w - 1, std::memory_order_relaxed);
+        }
+    }
+
+    static void pause() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+public:
+    elimination_array() : width(1) {}
+
+    elimination_array(const elimination_array &) = delete;
+    elimination_array &operator=(const elimination_array &) = delete;
+
+    // Offers `node` to a concurrent pop. Returns true if a pop took it, in
+    // which case the node now belongs to that pop.
+    bool try_push(Node *node) {
+        slot &s = slots[random_below(width.load(std::memory_order_relaxed))];
+        Node *expected = nullptr;
+        if (!s.offer.compare_exchange_strong(expected, node,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed)) {
+            grow(); // somebody else is using this slot
+            return false;
+        }
+        for (unsigned i = 0; i < spin_limit; ++i) {
+            if (s.offer.load(std::memory_order_relaxed) == taken()) {
+                s.offer.store(nullptr, std::memory_order_relaxed);
+                return true;
+            }
+            pause();
+        }
+        expected = node;
+        if (s.offer.compare_exchange_strong(expected, nullptr,
+                                            std::memory_order_relaxed)) {
+            shrink(); // nobody came
+            return false;
+        }
+        // a pop claimed it while we were withdrawing
+        s.offer.store(nullptr, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Takes a node offered by a concurrent push, or returns nullptr.
+    Node *try_pop() {
+        const unsigned w = width.load(std::memory_order_relaxed);
+        unsigned index = random_below(w);
+        for (unsigned i = 0; i < spin_limit; ++i) {
+            slot &s = slots[index];
+            Node *offered = s.offer.load(std::memory_order_relaxed);
+            if (offered != nullptr && offered != taken()) {
+                if (s.offer.compare_exchange_strong(
+                        offered, taken(), std::memory_order_acquire,
+                        std::memory_order_relaxed)) {
+                    return offered;
+                }
+                grow(); // lost the race to another pop
+            }
+            index = (index + 1) % w;
+            pause();
+        }
+        return nullptr;
+    }
+};
+
+template <typename T> class elimination_backoff_stack {
+private:
+    struct node {
+        T data;
+        node *next;
+
+        node(T data_) : data(std::move(data_)), next(nullptr) {}
+    };
+
+    std::atomic<node *> head;
+    elimination_array<node> eliminator;
+
+    bool try_push_once(node *new_node) {
+        new_node->next = head.load(std::memory_order_relaxed);
+        return head.compare_exchange_strong(new_node->next, new_node,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed);
+    }
+
+    // A single attempt to unlink the head. Returns the node, or nullptr with
+    // `contended` telling whether the stack was empty or the CAS failed.
+    node *try_pop_once(bool &contended) {
+        std::atomic<void *> &hp =
+            hazard_pointers::get_hazard_pointer_for_current_thread();
+        node *old_head = head.load();
+        node *temp;
+        do {
+            temp = old_head;
+            hp.store(old_head);
+            old_head = head.load();
+        } while (old_head != temp);
+        contended = false;
+        if (old_head && !head.compare_exchange_strong(old_head, old_head->next)) {
+            contended = true;
+            old_head = nullptr;
+        }
+        hp.store(nullptr);
+        return old_head;
+    }
+
+public:
+    elimination_backoff_stack() : head(nullptr) {}
+
+    elimination_backoff_stack(const elimination_backoff_stack &) = delete;
+    elimination_backoff_stack &
+    operator=(const elimination_backoff_stack &) = delete;
+
+    ~elimination_backoff_stack() {
+        node *p = head.load();
+        while (p) {
+            node *next = p->next;
+            delete p;
+            p = next;
+        }
+    }
+
+    void push(T new_value) {
+        node *const new_node = new node(std::move(new_value));
+        while (!try_push_once(new_node)) {
+            if (eliminator.try_push(new_node)) {
+                return;
+            }
+        }
+    }
+
+    std::optional<T> try_pop() {
+        bool contended;
+        node *n = try_pop_once(contended);
+        if (n) {
+            std::optional<T> res(std::move(n->data));
+            hazard_pointers::reclaim_later(n);
+            return res;
+        }
+        while (contended) {
+            if ((n = eliminator.try_pop())) {
+                std::optional<T> res(std::move(n->data));
+                delete n; // never reachable from the head
+                return res;
+            }
+            if ((n = try_pop_once(contended))) {
+                std::optional<T> res(std::move(n->data));
+                hazard_pointers::reclaim_later(n);
+                return res;
+            }
+        }
+        return std::nullopt;
+    }
+
+    bool try_pop(T &value) {
+        std::optional<T> res = try_pop();
+        if (!res) {
+            return false;
+        }
+        value = std::move(*res);
+        return true;
+    }
+
+    bool empty() const { return head.load() == nullptr; }
+};
+
+#endif // end of ELIMINATION_BACKOFF_STACK_HPP
@@ -0,0 +1,100 @@
+// Push/pop storm: threadsafe_stack vs. lock_free_stack vs.
+// elimination_backoff_stack
+//
+// usage: demo_3_6 [max threads] [operations per thread]
+// Half of the threads only push and the other half only pop, the pattern
+// where elimination pays off. The popped values are summed as a sanity check.
+#include "listing_3_5.h"
+#include "demo_3_3.hpp"
+#include "demo_3_5.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using steady_clock = std::chrono::steady_clock;
+
+struct mutex_stack_adapter {
+    threadsafe_stack<long> stack;
+
+    void push(long v) { stack.push(v); }
+
+    bool try_pop(long &v) {
+        try {
+            stack.pop(v);
+            return true;
+        } catch (const empty_stack &) {
+            return false;
+        }
+    }
+};
+
+// Returns million operations per second, or a negative value if values were
+// lost.
+template <typename Stack> double throughput(int threads, long per_thread) {
+    Stack stack;
+    std::atomic<long long> total(0);
+    std::vector<std::thread> workers;
+    const int pushers = std::max(1, threads / 2);
+    const int poppers = std::max(1, threads - pushers);
+    const long per_popper = per_thread * pushers / poppers;
+    auto t_start = steady_clock::now();
+    for (int t = 0; t < pushers; ++t) {
+        workers.emplace_back([&] {
+            for (long i = 1; i <= per_thread; ++i) {
+                stack.push(i);
+            }
+        });
+    }
+    for (int t = 0; t < poppers; ++t) {
+        workers.emplace_back([&, t] {
+            long long sum = 0;
+            long v;
+            const long count =
+                t == 0 ? per_thread * pushers - per_popper * (poppers - 1)
+                       : per_popper;
+            for (long i = 0; i < count;) {
+                if (stack.try_pop(v)) {
+                    sum += v;
+                    ++i;
+                }
+            }
+            total += sum;
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    auto elapse = std::chrono::duration_cast<std::chrono::microseconds>(
+        steady_clock::now() - t_start);
+    if (total != static_cast<long long>(pushers) * per_thread *
+                     (per_thread + 1) / 2) {
+        return -1.0;
+    }
+    return 2.0 * pushers * per_thread / std::max<long long>(elapse.count(), 1);
+}
+
+int main(int argc, char *argv[]) {
+    const int max_threads =
+        argc > 1 ? std::atoi(argv[1])
+                 : std::max(2u, std::thread::hardware_concurrency());
+    const long per_thread = argc > 2 ? std::atol(argv[2]) : 200'000;
+
+    std::cout << "Mops/s, half of the threads push and half pop\n"
+              << "threads\tthreadsafe_stack\tlock_free_stack\t"
+                 "elimination_backoff_stack"
+              << std::endl;
+    for (int threads = 2; threads <= max_threads; threads *= 2) {
+        std::cout << threads << '\t'
+                  << throughput<mutex_stack_adapter>(threads, per_thread)
+                  << "\t\t"
+                  << throughput<lock_free_stack<long>>(threads, per_thread)
+                  << "\t\t"
+                  << throughput<elimination_backoff_stack<long>>(threads,
+                                                                 per_thread)
+                  << std::endl;
+    }
+}
@@ -0,0 +1,99 @@
+// An allocator that recycles the memory it hands out
+//
+// std::stack and std::queue sit on a std::deque, which frees a block whenever
+// pops cross a block boundary and allocates a new one when pushes do. With
+// this allocator freed blocks go onto a free list and are handed out again,
+// so after warm-up a container doing steady push/pop traffic makes no heap
+// allocations at all.
+//
+// Every default-constructed allocator owns its own pool, shared by its copies
+// and rebound copies. The pool does no locking: it relies on the owning
+// container's mutex, as threadsafe_stack and threadsafe_queue provide.
+#ifndef RECYCLING_ALLOCATOR_HPP
+#define RECYCLING_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+class recycling_pool {
+private:
+    // one free list per block size; a deque only uses a couple of sizes
+    std::vector<std::pair<std::size_t, std::vector<void *>>> free_lists;
+
+    std::vector<void *> &free_list_for(std::size_t bytes) {
+        for (auto &entry : free_lists) {
+            if (entry.first == bytes) {
+                return entry.second;
+            }
+        }
+        free_lists.emplace_back(bytes, std::vector<void *>());
+        return free_lists.back().second;
+    }
+
+public:
+    recycling_pool() {}
+
+    recycling_pool(const recycling_pool &) = delete;
+    recycling_pool &operator=(const recycling_pool &) = delete;
+
+    ~recycling_pool() {
+        for (auto &entry : free_lists) {
+            for (void *p : entry.second) {
+                ::operator delete(p);
+            }
+        }
+    }
+
+    void *allocate(std::size_t bytes) {
+        std::vector<void *> &free_list = free_list_for(bytes);
+        if (free_list.empty()) {
+            return ::operator new(bytes);
+        }
+        void *p = free_list.back();
+        free_list.pop_back();
+        return p;
+    }
+
+    void deallocate(void *p, std::size_t bytes) {
+        free_list_for(bytes).push_back(p);
+    }
+};
+
+template <typename T> class recycling_allocator {
+private:
+    template <typename U> friend class recycling_allocator;
+
+    std::shared_ptr<recycling_pool> pool;
+
+public:
+    typedef T value_type;
+
+    recycling_allocator() : pool(std::make_shared<recycling_pool>()) {}
+
+    template <typename U>
+    recycling_allocator(const recycling_allocator<U> &other)
+        : pool(other.pool) {}
+
+    T *allocate(std::size_t n) {
+        static_assert(alignof(T) <= alignof(std::max_align_t),
+                      "over-aligned types are not supported");
+        return static_cast<T *>(pool->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n) { pool->deallocate(p, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const recycling_allocator<U> &other) const {
+        return pool == other.pool;
+    }
+
+    template <typename U>
+    bool operator!=(const recycling_allocator<U> &other) const {
+        return pool != other.pool;
+    }
+};
+
+#endif // end of RECYCLING_ALLOCATOR_HPP
@@ -0,0 +1,114 @@
+// Heap allocations per push/pop pair for the different pop flavours of
+// threadsafe_stack and threadsafe_queue
+#include "listing_3_5.h"
+#include "demo_3_7.hpp"
+#include "../ch04_synchronizing_concurrent_operations/listing_4_5.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+
+std::atomic<long> allocations(0);
+
+void *operator new(std::size_t size) {
+    ++allocations;
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+const long warm_up = 10'000;
+const long rounds = 1'000'000;
+
+// Runs `op` (one push and one pop) with a few elements already queued and
+// returns the allocations per call after warm-up.
+template <typename Op> double allocations_per_op(Op op) {
+    for (long i = 0; i < warm_up; ++i) {
+        op(i);
+    }
+    const long before = allocations;
+    for (long i = 0; i < rounds; ++i) {
+        op(i);
+    }
+    return double(allocations - before) / rounds;
+}
+
+template <typename Stack> void fill(Stack &s) {
+    for (long i = 0; i < 100; ++i) {
+        s.push(i);
+    }
+}
+
+void report(const std::string &name, double value) {
+    std::cout << std::left << std::setw(60) << name << value << std::endl;
+}
+
+int main() {
+    {
+        threadsafe_stack<long> s;
+        fill(s);
+        report("threadsafe_stack::pop() -> shared_ptr",
+               allocations_per_op([&](long i) {
+                   s.push(i);
+                   s.pop();
+               }));
+        report("threadsafe_stack::try_pop() -> optional",
+               allocations_per_op([&](long i) {
+                   s.push(i);
+                   s.try_pop();
+               }));
+        long v;
+        report("threadsafe_stack::try_pop(T &)",
+               allocations_per_op([&](long i) {
+                   s.push(i);
+                   s.try_pop(v);
+               }));
+    }
+    {
+        threadsafe_stack<long, recycling_allocator<long>> s;
+        fill(s);
+        long v;
+        report("threadsafe_stack<recycling_allocator>::try_pop(T &)",
+               allocations_per_op([&](long i) {
+                   s.push(i);
+                   s.try_pop(v);
+               }));
+    }
+    {
+        threadsafe_queue<long> q;
+        fill(q);
+        report("threadsafe_queue::try_pop() -> shared_ptr",
+               allocations_per_op([&](long i) {
+                   q.push(i);
+                   q.try_pop();
+               }));
+        report("threadsafe_queue::try_pop_value() -> optional",
+               allocations_per_op([&](long i) {
+                   q.push(i);
+                   q.try_pop_value();
+               }));
+        long v;
+        report("threadsafe_queue::wait_and_pop(T &)",
+               allocations_per_op([&](long i) {
+                   q.push(i);
+                   q.wait_and_pop(v);
+               }));
+    }
+    {
+        threadsafe_queue<long, recycling_allocator<long>> q;
+        fill(q);
+        long v;
+        report("threadsafe_queue<recycling_allocator>::wait_and_pop(T &)",
+               allocations_per_op([&](long i) {
+                   q.push(i);
+                   q.wait_and_pop(v);
+               }));
+    }
+}
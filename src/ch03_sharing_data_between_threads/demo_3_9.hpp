@@ -0,0 +1,264 @@
+// A concurrent open-addressing hash set for small integral keys
+//
+// - `contains` never locks, and outside of a resize it never writes to
+//   shared memory, so any number of readers proceed in parallel.
+// - `insert` claims an empty slot with a CAS (linear probing). Keys are never
+//   removed, so a probe sequence always ends at the first empty slot.
+// - Growing is incremental: once a table is half full a table twice the size
+//   is linked behind it, and every later insert or lookup moves one chunk
+//   of slots over, so a resize also completes under lookups alone. Empty slots of the old table are marked `moved` so that nothing can
+//   be added to them any more, and lookups search the old table and then the
+//   new one until the move is complete. Nobody ever waits for a full rehash.
+//
+// Old tables are kept until the set is destroyed: readers may still be
+// walking them and the sizes form a geometric series, so this costs less
+// than the final table again.
+#ifndef CONCURRENT_HASH_SET_HPP
+#define CONCURRENT_HASH_SET_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+template <typename Key> class concurrent_hash_set {
+private:
+    static_assert(std::is_integral<Key>::value && sizeof(Key) <= 4,
+                  "keys must be integers of at most 32 bits");
+
+    // slots hold `key + 2`, leaving 0 and 1 free as markers
+    static constexpr std::uint64_t empty = 0;
+    static constexpr std::uint64_t moved = 1;
+    static constexpr std::size_t migrate_chunk = 64;
+
+    struct table {
+        const std::size_t mask;
+        std::atomic<std::uint64_t> *const slots;
+        std::atomic<std::size_t> count;
+        std::atomic<table *> next;
+        std::atomic<std::size_t> migrate_cursor;
+        std::atomic<std::size_t> migrated;
+        // keys moved on to `next`; `count - moved_out` of them are still here
+        std::atomic<std::size_t> moved_out;
+
+        explicit table(std::size_t capacity)
+            : mask(capacity - 1),
+              slots(new std::atomic<std::uint64_t>[capacity]), count(0),
+              next(nullptr), migrate_cursor(0), migrated(0), moved_out(0) {
+            for (std::size_t i = 0; i < capacity; ++i) {
+                slots[i].store(empty, std::memory_order_relaxed);
+            }
+        }
+
+        ~table() { delete[] slots; }
+
+        std::size_t capacity() const { return mask + 1; }
+    };
+
+    enum class insert_result { inserted, present, table_moved };
+
+    table *const first;
+    // a lookup may move slots and advance it, hence mutable and the const
+    // helpers below
+    mutable std::atomic<table *> current;
+
+    static std::uint64_t encode(Key key) {
+        return static_cast<std::uint64_t>(
+                   static_cast<std::make_unsigned_t<Key>>(key)) +
+               2;
+    }
+
+    static std::size_t hash(std::uint64_t x) {
+        // the finalizer of MurmurHash3
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb3fe1a85ec53ULL;
+        x ^= x >> 33;
+        return static_cast<std::size_t>(x);
+    }
+
+    static bool find_in(const table *t, std::uint64_t k) {
+        for (std::size_t i = hash(k), n = 0; n <= t->mask; ++i, ++n) {
+            const std::uint64_t v =
+                t->slots[i & t->mask].load(std::memory_order_acquire);
+            if (v == k) {
+                return true;
+            }
+            if (v == empty || v == moved) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    static insert_result insert_into(table *t, std::uint64_t k) {
+        for (std::size_t i = hash(k), n = 0; n <= t->mask; ++i, ++n) {
+            std::atomic<std::uint64_t> &slot = t->slots[i & t->mask];
+            std::uint64_t v = slot.load(std::memory_order_acquire);
+            if (v == empty &&
+                slot.compare_exchange_strong(v, k, std::memory_order_acq_rel,
+                                             std::memory_order_acquire)) {
+                t->count.fetch_add(1, std::memory_order_relaxed);
+                return insert_result::inserted;
+            }
+            if (v == k) {
+                return insert_result::present;
+            }
+            if (v == moved) {
+                return insert_result::table_moved;
+            }
+        }
+        return insert_result::table_moved; // full, only possible mid-move
+    }
+
+    table *grow(table *t) const {
+        table *next = t->next.load(std::memory_order_acquire);
+        if (!next) {
+            table *bigger = new table(2 * t->capacity());
+            if (t->next.compare_exchange_strong(next, bigger,
+                                                std::memory_order_acq_rel)) {
+                next = bigger;
+            } else {
+                delete bigger; // another thread was faster
+            }
+        }
+        return next;
+    }
+
+    // Makes the first table that hasn't been moved out completely current.
+    void advance_current() const {
+        table *t = current.load(std::memory_order_acquire);
+        while (t->migrated.load(std::memory_order_acquire) == t->capacity()) {
+            table *next = t->next.load(std::memory_order_acquire);
+            if (current.compare_exchange_strong(t, next,
+                                                std::memory_order_acq_rel)) {
+                t = next;
+            }
+        }
+    }
+
+    // Moves one chunk of `t` into `t->next`; the thread that moves the last
+    // chunk makes the new table current.
+    void help_migrate(table *t) const {
+        table *next = t->next.load(std::memory_order_acquire);
+        const std::size_t begin =
+            t->migrate_cursor.fetch_add(migrate_chunk, std::memory_order_relaxed);
+        if (begin >= t->capacity()) {
+            return;
+        }
+        const std::size_t end = std::min(begin + migrate_chunk, t->capacity());
+        std::size_t keys = 0;
+        for (std::size_t i = begin; i < end; ++i) {
+            std::uint64_t v = t->slots[i].load(std::memory_order_acquire);
+            while (v == empty &&
+                   !t->slots[i].compare_exchange_weak(
+                       v, moved, std::memory_order_acq_rel,
+                       std::memory_order_acquire)) {
+            }
+            if (v != empty && v != moved) {
+                insert_into_newest(next, v);
+                ++keys;
+            }
+        }
+        t->moved_out.fetch_add(keys, std::memory_order_relaxed);
+        if (t->migrated.fetch_add(end - begin, std::memory_order_acq_rel) +
+                (end - begin) ==
+            t->capacity()) {
+            advance_current();
+        }
+    }
+
+    bool insert_into_newest(table *t, std::uint64_t k) const {
+        for (;;) {
+            table *next = t->next.load(std::memory_order_acquire);
+            if (next) {
+                help_migrate(t);
+                t = next;
+                continue;
+            }
+            if (t->count.load(std::memory_order_relaxed) >= t->capacity() / 2) {
+                grow(t);
+                continue;
+            }
+            switch (insert_into(t, k)) {
+            case insert_result::inserted:
+                return true;
+            case insert_result::present:
+                return false;
+            case insert_result::table_moved:
+                break; // a resize started meanwhile, go on with the next table
+            }
+        }
+    }
+
+public:
+    explicit concurrent_hash_set(std::size_t initial_capacity = 1024)
+        : first(new table([&] {
+              std::size_t c = 16;
+              while (c < initial_capacity) {
+                  c <<= 1;
+              }
+              return c;
+          }())),
+          current(first) {}
+
+    concurrent_hash_set(const concurrent_hash_set &) = delete;
+    concurrent_hash_set &operator=(const concurrent_hash_set &) = delete;
+
+    ~concurrent_hash_set() {
+        table *t = first;
+        while (t) {
+            table *next = t->next.load(std::memory_order_relaxed);
+            delete t;
+            t = next;
+        }
+    }
+
+    // Returns true if the key was added, false if it was already there. Two
+    // threads racing to insert the same key while a move starts may both get
+    // true; the set still ends up holding the key once.
+    bool insert(Key key) {
+        const std::uint64_t k = encode(key);
+        table *t = current.load(std::memory_order_acquire);
+        // during a move the key may still sit in one of the older tables
+        for (table *older = t; older->next.load(std::memory_order_acquire);
+             older = older->next.load(std::memory_order_acquire)) {
+            if (find_in(older, k)) {
+                return false;
+            }
+        }
+        return insert_into_newest(t, k);
+    }
+
+    bool contains(Key key) const {
+        const std::uint64_t k = encode(key);
+        table *const oldest = current.load(std::memory_order_acquire);
+        if (oldest->next.load(std::memory_order_acquire)) {
+            help_migrate(oldest);
+        }
+        for (const table *t = oldest; t;
+             t = t->next.load(std::memory_order_acquire)) {
+            if (find_in(t, k)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Number of keys, in the new table and still in the old ones during a
+    // move; only a snapshot while inserts are running.
+    std::size_t size() const {
+        std::size_t res = 0;
+        for (const table *t = current.load(std::memory_order_acquire); t;
+             t = t->next.load(std::memory_order_acquire)) {
+            // moved_out first: it never exceeds a later count
+            const std::size_t gone = t->moved_out.load(std::memory_order_relaxed);
+            res += t->count.load(std::memory_order_relaxed) - gone;
+        }
+        return res;
+    }
+};
+
+#endif // end of CONCURRENT_HASH_SET_HPP
@@ -0,0 +1,90 @@
+// Listing 3.5 A fleshed-out class definition for a thread-safe stack
+#ifndef THREADSAFE_STACK_H
+#define THREADSAFE_STACK_H
+
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stack>
+#include <utility>
+
+struct empty_stack : std::exception {
+    const char *what() const noexcept {
+        return "empty stack";
+    }
+};
+
+// `Allocator` is used by the underlying std::deque; see recycling_allocator
+// (demo_3_7.hpp) for one that avoids heap allocations in steady state.
+// `Mutex` can be any lockable, e.g. profiled_mutex (demo_3_14.hpp).
+template <typename T, typename Allocator = std::allocator<T>,
+          typename Mutex = std::mutex>
+class threadsafe_stack {
+public:
+    threadsafe_stack() {}
+    
+    threadsafe_stack(const threadsafe_stack &other) {
+        std::lock_guard<Mutex> lck(mtx);
+        data = other.data;
+    }
+
+    threadsafe_stack &operator=(const threadsafe_stack &) = delete;
+
+    void push(T new_value) {
+        std::lock_guard<Mutex> lck(mtx);
+        data.push(std::move(new_value));
+    }
+
+    void pop(T &value) {
+        std::lock_guard<Mutex> lck(mtx);
+        if (data.empty()) {
+            throw empty_stack();
+        }
+        value = std::move(data.top());
+        data.pop();
+    }
+
+    std::shared_ptr<T> pop() {
+        std::lock_guard<Mutex> lck(mtx);
+        if (data.empty()) {
+            throw empty_stack();
+        }
+        const std::shared_ptr<T> res(std::make_shared<T>(std::move(data.top())));
+        data.pop();
+        return res;
+    }
+
+    // Non-throwing pops that don't allocate: an empty stack is reported
+    // through the return value.
+    bool try_pop(T &value) {
+        std::lock_guard<Mutex> lck(mtx);
+        if (data.empty()) {
+            return false;
+        }
+        value = std::move(data.top());
+        data.pop();
+        return true;
+    }
+
+    std::optional<T> try_pop() {
+        std::lock_guard<Mutex> lck(mtx);
+        if (data.empty()) {
+            return std::nullopt;
+        }
+        std::optional<T> res(std::move(data.top()));
+        data.pop();
+        return res;
+    }
+
+    bool empty() const {
+        std::lock_guard<Mutex> lck(mtx);
+        return data.empty();
+    }
+private:
+    std::stack<T, std::deque<T, Allocator>> data;
+    mutable Mutex mtx;
+};
+
+#endif // end of THREADSAFE_STACK_H
\ No newline at end of file
@@ -1,17 +1,57 @@
 // Listing 3.8 A simple hierarchical mutex
+//
+// The checking is a policy of basic_hierarchical_mutex:
+// - unchecked_hierarchy: no checks at all, the mutex is a plain std::mutex.
+//   The default when NDEBUG is defined.
+// - hierarchy_value_check: the check of Listing 3.8, throws
+//   std::logic_error when a thread locks against the hierarchy. The default
+//   otherwise.
+// - lock_order_check: lockdep-style, records which mutexes are locked while
+//   holding which in a global lock-order graph and reports a possible
+//   deadlock, with the call stacks of both acquisitions, as soon as an order
+//   closes a cycle. The default when HIERARCHICAL_MUTEX_LOCK_ORDER_CHECK is
+//   defined (and NDEBUG isn't).
 #ifndef HIERARCHICAL_MUTEX_H
 #define HIERARCHICAL_MUTEX_H
 
+#include <atomic>
+#include <cstdio>
+#include <functional>
 #include <limits>
+#include <map>
 #include <mutex>
+#include <set>
 #include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#if defined(__has_include)
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define HIERARCHICAL_MUTEX_HAS_BACKTRACE 1
+#endif
+#endif
 
-class hierarchical_mutex {
+class unchecked_hierarchy {
+protected:
+    explicit unchecked_hierarchy(unsigned long) {}
+
+    void check_for_hierarchy_violation() {}
+    void update_hierarchy_value() {}
+    void restore_hierarchy_value() {}
+    void lock_failed() {}
+};
+
+class hierarchy_value_check {
 private:
     const unsigned long hierarchy_value;
     unsigned long previous_hierarchy_value;
-    std::mutex internal_mutex;
-    thread_local static unsigned long this_thread_hierarchy_value;
+    inline thread_local static unsigned long this_thread_hierarchy_value{
+        std::numeric_limits<unsigned long>::max()};
+
+protected:
+    explicit hierarchy_value_check(unsigned long value)
+        : hierarchy_value(value), previous_hierarchy_value(0) {}
 
     void check_for_hierarchy_violation() {
         if (this_thread_hierarchy_value <= hierarchy_value) {
@@ -24,35 +64,242 @@ private:
         this_thread_hierarchy_value = hierarchy_value;
     }
 
+    void restore_hierarchy_value() {
+        if (this_thread_hierarchy_value != hierarchy_value) {
+            throw std::logic_error("mutex hierarchy violated");
+        }
+        this_thread_hierarchy_value = previous_hierarchy_value;
+    }
+
+    void lock_failed() {}
+};
+
+namespace lock_order {
+
+struct call_stack {
+    static constexpr int max_depth = 32;
+    void *frames[max_depth];
+    int depth = 0;
+
+    static call_stack capture() {
+        call_stack res;
+#ifdef HIERARCHICAL_MUTEX_HAS_BACKTRACE
+        res.depth = backtrace(res.frames, max_depth);
+#endif
+        return res;
+    }
+
+    void print(std::FILE *out) const {
+#ifdef HIERARCHICAL_MUTEX_HAS_BACKTRACE
+        std::fflush(out);
+        backtrace_symbols_fd(frames, depth, fileno(out));
+#else
+        std::fputs("    (no stack traces on this platform)\n", out);
+#endif
+    }
+};
+
+struct lock_info {
+    unsigned long id;
+    unsigned long hierarchy_value;
+};
+
+// `first` was held when `second` was locked; the stacks are those of the
+// first time this happened
+struct edge {
+    lock_info first, second;
+    call_stack first_acquired, second_acquired;
+};
+
+struct cycle_report {
+    // the order that closes the cycle
+    edge new_order;
+    // the chain of orders seen before, from `new_order.second` back to
+    // `new_order.first`
+    std::vector<edge> existing_orders;
+};
+
+inline void print_report(const cycle_report &report) {
+    auto print_lock = [](const char *what, const lock_info &lock) {
+        std::fprintf(stderr, "  %s mutex #%lu (hierarchy value %lu)", what,
+                     lock.id, lock.hierarchy_value);
+    };
+    auto print_edge = [&](const edge &e) {
+        print_lock("holding", e.first);
+        std::fputs(", locked at:\n", stderr);
+        e.first_acquired.print(stderr);
+        print_lock("then locking", e.second);
+        std::fputs(", at:\n", stderr);
+        e.second_acquired.print(stderr);
+    };
+    std::fputs("possible deadlock: inconsistent lock order\n", stderr);
+    print_edge(report.new_order);
+    std::fputs("but earlier, in this order:\n", stderr);
+    for (const auto &e : report.existing_orders) {
+        print_edge(e);
+    }
+    std::fflush(stderr);
+}
+
+class graph {
+private:
+    std::mutex mtx;
+    std::map<std::pair<unsigned long, unsigned long>, edge> edges;
+    std::map<unsigned long, std::set<unsigned long>> successors;
+    std::function<void(const cycle_report &)> handler = print_report;
+
+    // Depth-first search for a path `from` -> ... -> `to`.
+    bool find_path(unsigned long from, unsigned long to,
+                   std::set<unsigned long> &visited,
+                   std::vector<edge> &path) {
+        if (from == to) {
+            return true;
+        }
+        if (!visited.insert(from).second) {
+            return false;
+        }
+        auto it = successors.find(from);
+        if (it == successors.end()) {
+            return false;
+        }
+        for (unsigned long next : it->second) {
+            path.push_back(edges.at({from, next}));
+            if (find_path(next, to, visited, path)) {
+                return true;
+            }
+            path.pop_back();
+        }
+        return false;
+    }
+
 public:
-    explicit hierarchical_mutex(unsigned long value)
-        : hierarchy_value(value), previous_hierarchy_value(0) {}
+    void set_handler(std::function<void(const cycle_report &)> h) {
+        std::lock_guard<std::mutex> lk(mtx);
+        handler = std::move(h);
+    }
+
+    // Records that `e.second` is locked while holding `e.first`.
+    void add(const edge &e) {
+        cycle_report report;
+        std::function<void(const cycle_report &)> h;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            const auto key = std::make_pair(e.first.id, e.second.id);
+            if (edges.count(key)) {
+                return;
+            }
+            std::set<unsigned long> visited;
+            if (!find_path(e.second.id, e.first.id, visited,
+                           report.existing_orders)) {
+                edges.emplace(key, e);
+                successors[e.first.id].insert(e.second.id);
+                return;
+            }
+            // remember the pair so that it is reported only once, but keep
+            // it out of `successors` so the graph stays acyclic
+            edges.emplace(key, e);
+            report.new_order = e;
+            h = handler;
+        }
+        if (h) {
+            h(report);
+        }
+    }
+};
+
+inline graph global_graph;
+inline std::atomic<unsigned long> next_id(1);
+
+struct held_lock {
+    lock_info lock;
+    call_stack acquired;
+};
+
+inline thread_local std::vector<held_lock> held_locks;
+
+// Replaces the default report, which prints to stderr.
+inline void set_cycle_handler(std::function<void(const cycle_report &)> h) {
+    global_graph.set_handler(std::move(h));
+}
+
+} // namespace lock_order
+
+class lock_order_check {
+private:
+    const lock_order::lock_info info;
+
+protected:
+    explicit lock_order_check(unsigned long value)
+        : info{lock_order::next_id++, value} {}
+
+    void check_for_hierarchy_violation() {
+        const lock_order::call_stack here = lock_order::call_stack::capture();
+        for (const auto &held : lock_order::held_locks) {
+            lock_order::global_graph.add(
+                lock_order::edge{held.lock, info, held.acquired, here});
+        }
+        lock_order::held_locks.push_back({info, here});
+    }
+
+    void update_hierarchy_value() {}
+
+    void restore_hierarchy_value() {
+        auto &held = lock_order::held_locks;
+        for (auto it = held.rbegin(); it != held.rend(); ++it) {
+            if (it->lock.id == info.id) {
+                held.erase(std::next(it).base());
+                return;
+            }
+        }
+    }
+
+    // undoes check_for_hierarchy_violation() when try_lock fails
+    void lock_failed() { restore_hierarchy_value(); }
+};
+
+#if defined(NDEBUG)
+using default_hierarchy_policy = unchecked_hierarchy;
+#elif defined(HIERARCHICAL_MUTEX_LOCK_ORDER_CHECK)
+using default_hierarchy_policy = lock_order_check;
+#else
+using default_hierarchy_policy = hierarchy_value_check;
+#endif
+
+template <typename CheckPolicy = default_hierarchy_policy>
+class basic_hierarchical_mutex : private CheckPolicy {
+private:
+    std::mutex internal_mutex;
+
+public:
+    explicit basic_hierarchical_mutex(unsigned long value)
+        : CheckPolicy(value) {}
 
     void lock() {
-        check_for_hierarchy_violation();
+        this->check_for_hierarchy_violation();
         internal_mutex.lock();
-        update_hierarchy_value();
+        this->update_hierarchy_value();
     }
 
     bool try_lock() {
-        check_for_hierarchy_violation();
+        this->check_for_hierarchy_violation();
         if (!internal_mutex.try_lock()) {
+            this->lock_failed();
             return false;
         }
-        update_hierarchy_value();
+        this->update_hierarchy_value();
         return true;
     }
 
     void unlock() {
-        if (this_thread_hierarchy_value != hierarchy_value) {
-            throw std::logic_error("mutex hierarchy violated");
-        }
-        this_thread_hierarchy_value = previous_hierarchy_value;
+        this->restore_hierarchy_value();
         internal_mutex.unlock();
     }
 };
 
-thread_local unsigned long hierarchical_mutex::this_thread_hierarchy_value{
-    std::numeric_limits<unsigned long>::max()};
+static_assert(sizeof(basic_hierarchical_mutex<unchecked_hierarchy>) ==
+                  sizeof(std::mutex),
+              "an unchecked hierarchical_mutex must cost no more than a mutex");
+
+using hierarchical_mutex = basic_hierarchical_mutex<>;
 
 #endif // end of HIERARCHICAL_MUTEX_H
\ No newline at end of file
@@ -0,0 +1,61 @@
+// Producer/consumer throughput: threadsafe_queue vs. fine_grained_queue
+//
+// usage: demo_4_10 [max threads per side] [items per producer]
+#include "listing_4_5.hpp"
+#include "demo_4_9.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using steady_clock = std::chrono::steady_clock;
+
+// Returns the throughput in items per millisecond.
+template <typename Queue> double throughput(int threads, long items) {
+    Queue queue;
+    std::atomic<long long> total(0);
+    std::vector<std::thread> workers;
+    auto t_start = steady_clock::now();
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back([&] {
+            for (long j = 1; j <= items; ++j) {
+                queue.push(j);
+            }
+        });
+        workers.emplace_back([&] {
+            long long sum = 0;
+            long value;
+            for (long j = 0; j < items; ++j) {
+                queue.wait_and_pop(value);
+                sum += value;
+            }
+            total += sum;
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    auto elapse = std::chrono::duration_cast<std::chrono::microseconds>(
+        steady_clock::now() - t_start);
+    if (total != static_cast<long long>(threads) * items * (items + 1) / 2) {
+        std::cerr << "wrong sum" << std::endl;
+        std::exit(1);
+    }
+    return threads * items * 1000.0 / std::max<long long>(elapse.count(), 1);
+}
+
+int main(int argc, char *argv[]) {
+    const int max_threads = argc > 1 ? std::atoi(argv[1]) : 8;
+    const long items = argc > 2 ? std::atol(argv[2]) : 100'000;
+    std::cout << "items/ms with N producers and N consumers\n"
+              << "N\tthreadsafe_queue\tfine_grained_queue" << std::endl;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        std::cout << threads << '\t'
+                  << throughput<threadsafe_queue<long>>(threads, items) << "\t\t"
+                  << throughput<fine_grained_queue<long>>(threads, items)
+                  << std::endl;
+    }
+}
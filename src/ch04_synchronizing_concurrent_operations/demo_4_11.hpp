@@ -0,0 +1,299 @@
+// In-place parallel introsort for random-access ranges
+//
+// Listings 4.12 and 4.13 sort a std::list they take by value and use the
+// first element as pivot, which makes sorted input quadratic. parallel_sort
+// sorts any random-access range in place:
+//
+// - the pivot is the median of three elements, or for large ranges the
+//   median of three such medians (Tukey's ninther);
+// - a partition that finds nothing smaller than the pivot partitions once
+//   more to put all elements equal to it aside, so inputs with few distinct
+//   values don't degrade;
+// - below `insertion_sort_cutoff` elements it uses insertion sort, and past
+//   a recursion depth of 2 log2(n) it falls back to heapsort, which bounds
+//   the worst case to O(n log n);
+// - the smaller side of every partition of more than `task_cutoff` elements
+//   becomes a task on the thread pool of demo_4_5.hpp, and ranges of more
+//   than `parallel_partition_cutoff` elements, which only occur at the top
+//   levels, are partitioned by all threads together;
+// - ints, longs, floats and doubles in contiguous storage compared with
+//   std::less are partitioned by the branch-free kernels of demo_4_13.hpp.
+#ifndef PARALLEL_INTROSORT_HPP
+#define PARALLEL_INTROSORT_HPP
+
+#include "demo_4_13.hpp"
+#include "demo_4_5.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace introsort_detail {
+
+constexpr std::ptrdiff_t insertion_sort_cutoff = 24;
+constexpr std::ptrdiff_t ninther_cutoff = 128;
+constexpr std::ptrdiff_t task_cutoff = 1 << 14;
+constexpr std::ptrdiff_t parallel_partition_cutoff = 1 << 20;
+// smallest piece of work a parallel partition hands to one thread
+constexpr std::ptrdiff_t partition_block_size = 1 << 16;
+
+template <typename RandomIt, typename Compare>
+void insertion_sort(RandomIt first, RandomIt last, Compare comp) {
+    if (first == last) {
+        return;
+    }
+    for (RandomIt i = first + 1; i != last; ++i) {
+        auto value = std::move(*i);
+        RandomIt j = i;
+        for (; j != first && comp(value, *(j - 1)); --j) {
+            *j = std::move(*(j - 1));
+        }
+        *j = std::move(value);
+    }
+}
+
+template <typename RandomIt, typename Compare>
+void sort3(RandomIt a, RandomIt b, RandomIt c, Compare comp) {
+    if (comp(*b, *a)) {
+        std::iter_swap(a, b);
+    }
+    if (comp(*c, *b)) {
+        std::iter_swap(b, c);
+        if (comp(*b, *a)) {
+            std::iter_swap(a, b);
+        }
+    }
+}
+
+// Moves the chosen pivot to *first.
+template <typename RandomIt, typename Compare>
+void choose_pivot(RandomIt first, RandomIt last, Compare comp) {
+    const auto n = last - first;
+    const RandomIt mid = first + n / 2;
+    if (n > ninther_cutoff) {
+        const auto s = n / 8;
+        sort3(first, first + s, first + 2 * s, comp);
+        sort3(mid - s, mid, mid + s, comp);
+        sort3(last - 1 - 2 * s, last - 1 - s, last - 1, comp);
+        sort3(first + s, mid, last - 1 - s, comp);
+    } else {
+        sort3(first, mid, last - 1, comp);
+    }
+    std::iter_swap(first, mid);
+}
+
+// The positions, as ranges of offsets, of elements on the wrong side.
+using offset_ranges = std::vector<std::pair<std::ptrdiff_t, std::ptrdiff_t>>;
+
+// Walks the elements of a list of offset ranges in order.
+class offset_cursor {
+private:
+    const offset_ranges &ranges;
+    std::size_t range = 0;
+    std::ptrdiff_t pos = 0;
+
+public:
+    offset_cursor(const offset_ranges &ranges_, std::ptrdiff_t skip)
+        : ranges(ranges_) {
+        while (skip >= ranges[range].second - ranges[range].first) {
+            skip -= ranges[range].second - ranges[range].first;
+            ++range;
+        }
+        pos = ranges[range].first + skip;
+    }
+
+    std::ptrdiff_t operator*() const { return pos; }
+
+    offset_cursor &operator++() {
+        if (++pos == ranges[range].second && range + 1 < ranges.size()) {
+            pos = ranges[++range].first;
+        }
+        return *this;
+    }
+};
+
+// `local(first, last)` partitions a block on one thread and returns the
+// partition point.
+template <typename RandomIt, typename LocalPartition>
+RandomIt parallel_partition(thread_pool &pool, RandomIt first, RandomIt last,
+                            LocalPartition local) {
+    const std::ptrdiff_t n = last - first;
+    const std::ptrdiff_t blocks = std::max<std::ptrdiff_t>(
+        1, std::min<std::ptrdiff_t>(4 * pool.size(), n / partition_block_size));
+    const std::ptrdiff_t block_size = (n + blocks - 1) / blocks;
+
+    // partition every block on its own
+    std::vector<std::ptrdiff_t> mids(blocks);
+    auto partition_block = [=, &mids](std::ptrdiff_t b) {
+        const RandomIt block_first = first + b * block_size;
+        const RandomIt block_last = first + std::min(n, (b + 1) * block_size);
+        mids[b] = local(block_first, block_last) - first;
+    };
+    std::vector<std::future<void>> pending;
+    for (std::ptrdiff_t b = 1; b < blocks; ++b) {
+        pending.push_back(pool.submit([=] { partition_block(b); }));
+    }
+    partition_block(0);
+    for (auto &f : pending) {
+        pool.wait(f);
+        f.get();
+    }
+
+    // the first `split` elements must end up in the lower part
+    std::ptrdiff_t split = 0;
+    for (std::ptrdiff_t b = 0; b < blocks; ++b) {
+        split += mids[b] - b * block_size;
+    }
+    offset_ranges misplaced_high, misplaced_low;
+    for (std::ptrdiff_t b = 0; b < blocks; ++b) {
+        const std::ptrdiff_t block_first = b * block_size;
+        const std::ptrdiff_t block_last = std::min(n, (b + 1) * block_size);
+        const std::ptrdiff_t high_end = std::min(block_last, split);
+        if (mids[b] < high_end) {
+            misplaced_high.emplace_back(mids[b], high_end);
+        }
+        const std::ptrdiff_t low_begin = std::max(block_first, split);
+        if (low_begin < mids[b]) {
+            misplaced_low.emplace_back(low_begin, mids[b]);
+        }
+    }
+
+    // swap the i-th misplaced element on the left with the i-th on the right
+    std::ptrdiff_t misplaced = 0;
+    for (const auto &r : misplaced_high) {
+        misplaced += r.second - r.first;
+    }
+    auto swap_misplaced = [=, &misplaced_high, &misplaced_low](
+                              std::ptrdiff_t begin, std::ptrdiff_t count) {
+        offset_cursor high(misplaced_high, begin), low(misplaced_low, begin);
+        for (std::ptrdiff_t i = 0; i < count; ++i, ++high, ++low) {
+            std::iter_swap(first + *high, first + *low);
+        }
+    };
+    pending.clear();
+    std::ptrdiff_t begin = 0;
+    for (; misplaced - begin > partition_block_size;
+         begin += partition_block_size) {
+        pending.push_back(pool.submit(
+            [=] { swap_misplaced(begin, partition_block_size); }));
+    }
+    if (begin < misplaced) {
+        swap_misplaced(begin, misplaced - begin);
+    }
+    for (auto &f : pending) {
+        pool.wait(f);
+        f.get();
+    }
+    return first + split;
+}
+
+template <typename RandomIt, typename LocalPartition>
+RandomIt partition(thread_pool *pool, RandomIt first, RandomIt last,
+                   LocalPartition local) {
+    if (pool && pool->size() > 1 && last - first > parallel_partition_cutoff) {
+        return parallel_partition(*pool, first, last, local);
+    }
+    return local(first, last);
+}
+
+// Moves the elements x with comp(x, pivot) to the front.
+template <typename RandomIt, typename Compare>
+RandomIt partition_less(
+    RandomIt first, RandomIt last,
+    const typename std::iterator_traits<RandomIt>::value_type &pivot,
+    Compare comp) {
+    if constexpr (simd_partition::applies<RandomIt, Compare>::value) {
+        if (first == last) {
+            return first;
+        }
+        const auto p = &*first;
+        return first +
+               (simd_partition::partition_less(p, p + (last - first), pivot) - p);
+    } else {
+        return std::partition(first, last,
+                              [&](const auto &x) { return comp(x, pivot); });
+    }
+}
+
+template <typename RandomIt, typename Compare>
+void sort_range(thread_pool *pool, RandomIt first, RandomIt last,
+                Compare comp, int depth_limit) {
+    std::vector<std::future<void>> children;
+    while (last - first > insertion_sort_cutoff) {
+        if (depth_limit-- == 0) {
+            std::make_heap(first, last, comp);
+            std::sort_heap(first, last, comp);
+            first = last;
+            break;
+        }
+        choose_pivot(first, last, comp);
+        const auto &pivot = *first;
+        RandomIt mid =
+            partition(pool, first + 1, last, [&](RandomIt f, RandomIt l) {
+                return partition_less(f, l, pivot, comp);
+            });
+        if (mid == first + 1) {
+            // the pivot is the smallest element: skip all its equals
+            first = partition(pool, first + 1, last, [&](RandomIt f, RandomIt l) {
+                return std::partition(f, l, [&](const auto &x) {
+                    return !comp(pivot, x);
+                });
+            });
+            continue;
+        }
+        std::iter_swap(first, mid - 1);
+        // [first, mid - 1) < pivot, [mid, last) >= pivot
+
+        // recurse into the smaller side and loop on the larger one
+        RandomIt small_first = first, small_last = mid - 1;
+        if (small_last - small_first > last - mid) {
+            small_first = mid;
+            small_last = last;
+            last = mid - 1;
+        } else {
+            first = mid;
+        }
+        if (pool && small_last - small_first > task_cutoff) {
+            children.push_back(pool->submit([=] {
+                sort_range(pool, small_first, small_last, comp, depth_limit);
+            }));
+        } else {
+            sort_range(pool, small_first, small_last, comp, depth_limit);
+        }
+    }
+    insertion_sort(first, last, comp);
+    for (auto &f : children) {
+        pool->wait(f);
+        f.get();
+    }
+}
+
+inline int depth_limit_for(std::ptrdiff_t n) {
+    int log2 = 0;
+    for (; n > 1; n >>= 1) {
+        ++log2;
+    }
+    return 2 * log2;
+}
+
+} // namespace introsort_detail
+
+template <typename RandomIt, typename Compare = std::less<>>
+void parallel_sort(thread_pool &pool, RandomIt first, RandomIt last,
+                   Compare comp = Compare()) {
+    introsort_detail::sort_range(&pool, first, last, comp,
+                                 introsort_detail::depth_limit_for(last - first));
+}
+
+// The same algorithm on the calling thread alone.
+template <typename RandomIt, typename Compare = std::less<>>
+void introsort(RandomIt first, RandomIt last, Compare comp = Compare()) {
+    introsort_detail::sort_range<RandomIt, Compare>(
+        nullptr, first, last, comp,
+        introsort_detail::depth_limit_for(last - first));
+}
+
+#endif // end of PARALLEL_INTROSORT_HPP
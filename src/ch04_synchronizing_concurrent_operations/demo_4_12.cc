@@ -0,0 +1,89 @@
+// Sorting large vectors in place: std::sort vs. introsort vs. parallel_sort
+//
+// usage: demo_4_12 [number of elements]
+// Sorts random and already sorted ints, and random records by key, and
+// checks every result against std::sort. Listing 4.13's parallel_quicksort
+// (as async_quicksort in demo_4_26.hpp) is timed on a list of a hundredth of
+// the size for comparison; on sorted input it would be quadratic.
+#include "demo_4_11.hpp"
+#include "demo_4_26.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using steady_clock = std::chrono::steady_clock;
+
+struct record {
+    int key;
+    int payload[3];
+};
+
+bool by_key(const record &a, const record &b) { return a.key < b.key; }
+
+template <typename F> long long time_ms(F f) {
+    auto t_start = steady_clock::now();
+    f();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               steady_clock::now() - t_start)
+        .count();
+}
+
+template <typename T, typename Compare>
+bool run(thread_pool &pool, const std::string &name, const std::vector<T> &input,
+         Compare comp) {
+    std::vector<T> expected(input), sequential(input), parallel(input);
+    const long long std_ms =
+        time_ms([&] { std::sort(expected.begin(), expected.end(), comp); });
+    const long long intro_ms =
+        time_ms([&] { introsort(sequential.begin(), sequential.end(), comp); });
+    const long long parallel_ms = time_ms(
+        [&] { parallel_sort(pool, parallel.begin(), parallel.end(), comp); });
+    auto same = [&](const std::vector<T> &v) {
+        return std::equal(v.begin(), v.end(), expected.begin(),
+                          [&](const T &a, const T &b) {
+                              return !comp(a, b) && !comp(b, a);
+                          });
+    };
+    const bool ok = same(sequential) && same(parallel);
+    std::cout << name << '\t' << std_ms << "\t\t" << intro_ms << "\t\t"
+              << parallel_ms << (ok ? "" : "\tWRONG") << std::endl;
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    const long n = argc > 1 ? std::atol(argv[1]) : 10'000'000;
+    thread_pool pool;
+    std::mt19937 engine(42);
+    std::uniform_int_distribution<int> dist;
+
+    std::vector<int> random_ints(n);
+    for (auto &x : random_ints) {
+        x = dist(engine);
+    }
+    std::vector<int> sorted_ints(random_ints);
+    std::sort(sorted_ints.begin(), sorted_ints.end());
+    std::vector<record> records(n);
+    for (auto &r : records) {
+        r.key = dist(engine);
+    }
+
+    std::cout << "sorting " << n << " elements with " << pool.size()
+              << " threads\n"
+              << "input\t\tstd::sort(ms)\tintrosort(ms)\tparallel_sort(ms)"
+              << std::endl;
+    bool ok = run(pool, "random ints", random_ints, std::less<>());
+    ok = run(pool, "sorted ints", sorted_ints, std::less<>()) && ok;
+    ok = run(pool, "records\t", records, by_key) && ok;
+
+    std::list<int> list(random_ints.begin(), random_ints.begin() + n / 100);
+    std::cout << "\nListing 4.13 on " << list.size() << " random ints: "
+              << time_ms([&] { list = async_quicksort(list); }) << "ms"
+              << std::endl;
+    return ok ? 0 : 1;
+}
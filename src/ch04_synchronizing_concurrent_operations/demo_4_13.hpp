@@ -0,0 +1,459 @@
+// Branch-free partitioning of primitive keys
+//
+// std::partition with a `t < pivot` predicate branches on every comparison,
+// and on random data the branch goes either way half of the time. For
+// int32/int64/float/double keys in contiguous storage, partition_less
+// moves all elements less than the pivot to the front without branching on
+// the data:
+//
+// - with AVX-512 it compares a whole vector against the pivot and writes
+//   the smaller elements to the front and the others to the back with two
+//   compress-stores;
+// - with AVX2, which has no compress-store, a permutation from a table
+//   indexed by the comparison mask gathers the smaller elements in the
+//   lower lanes and the others in the upper lanes, and the vector is stored
+//   at both ends;
+// - otherwise it uses block partitioning (Edelkamp and Weiß, BlockQuicksort):
+//   it records the offsets of misplaced elements of a block from each end
+//   without branches, then swaps them pairwise.
+//
+// Like in listing_2_9.cc the kernels are compiled once per instruction set
+// and the best one is picked at run time.
+#ifndef SIMD_PARTITION_HPP
+#define SIMD_PARTITION_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_PARTITION_X86 1
+#include <immintrin.h>
+#endif
+
+namespace simd_partition {
+
+template <typename T> T *block_partition(T *first, T *last, const T pivot) {
+    constexpr int block = 128;
+    unsigned char offsets_l[block], offsets_r[block];
+    int start_l = 0, num_l = 0, start_r = 0, num_r = 0;
+    // [first, l) is known to be less than the pivot, [r, last) not
+    T *l = first, *r = last;
+    while (r - l >= 2 * block) {
+        if (num_l == 0) {
+            start_l = 0;
+            for (int i = 0; i < block; ++i) {
+                offsets_l[num_l] = static_cast<unsigned char>(i);
+                num_l += !(l[i] < pivot);
+            }
+        }
+        if (num_r == 0) {
+            start_r = 0;
+            for (int i = 0; i < block; ++i) {
+                offsets_r[num_r] = static_cast<unsigned char>(i);
+                num_r += r[-1 - i] < pivot;
+            }
+        }
+        const int num = std::min(num_l, num_r);
+        for (int i = 0; i < num; ++i) {
+            std::swap(l[offsets_l[start_l + i]], r[-1 - offsets_r[start_r + i]]);
+        }
+        num_l -= num;
+        num_r -= num;
+        start_l += num;
+        start_r += num;
+        if (num_l == 0) {
+            l += block;
+        }
+        if (num_r == 0) {
+            r -= block;
+        }
+    }
+    // at most a few blocks are left
+    return std::partition(l, r, [&](const T &x) { return x < pivot; });
+}
+
+#ifdef SIMD_PARTITION_X86
+// Permutations that move the lanes whose bit is set in the index to the
+// front, keeping their order, and the others behind them.
+struct permutation_tables {
+    alignas(32) std::int32_t lanes32[256][8];
+    alignas(32) std::int32_t lanes64[16][8];
+
+    constexpr permutation_tables() : lanes32(), lanes64() {
+        for (int mask = 0; mask < 256; ++mask) {
+            int n = 0;
+            for (int lane = 0; lane < 8; ++lane) {
+                if (mask & (1 << lane)) {
+                    lanes32[mask][n++] = lane;
+                }
+            }
+            for (int lane = 0; lane < 8; ++lane) {
+                if (!(mask & (1 << lane))) {
+                    lanes32[mask][n++] = lane;
+                }
+            }
+        }
+        for (int mask = 0; mask < 16; ++mask) {
+            for (int i = 0; i < 4; ++i) {
+                // a 64-bit lane is a pair of 32-bit lanes
+                lanes64[mask][2 * i] = 2 * lanes32[mask][i];
+                lanes64[mask][2 * i + 1] = 2 * lanes32[mask][i] + 1;
+            }
+        }
+    }
+};
+
+inline constexpr permutation_tables tables{};
+
+// The kernels below are flattened into the entry points compiled for the
+// matching instruction set, so none of these remain a call.
+#define SIMD_PARTITION_AVX2 __attribute__((target("avx2")))
+#define SIMD_PARTITION_AVX512 __attribute__((target("avx512f")))
+
+template <typename T> struct avx2_ops;
+
+template <> struct avx2_ops<std::int32_t> {
+    using value_type = std::int32_t;
+    using vec = __m256i;
+    static constexpr int lanes = 8;
+
+    SIMD_PARTITION_AVX2 static vec load(const value_type *p) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    }
+    SIMD_PARTITION_AVX2 static void store(value_type *p, vec v) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+    }
+    SIMD_PARTITION_AVX2 static vec set1(value_type x) {
+        return _mm256_set1_epi32(x);
+    }
+    SIMD_PARTITION_AVX2 static unsigned less_mask(vec v, vec pivot) {
+        return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(pivot, v)));
+    }
+    // smaller elements to [low, ...), the others to [..., high)
+    SIMD_PARTITION_AVX2 static void split(value_type *low, value_type *high,
+                                          vec v, unsigned mask) {
+        const vec permuted = _mm256_permutevar8x32_epi32(
+            v, _mm256_load_si256(
+                   reinterpret_cast<const __m256i *>(tables.lanes32[mask])));
+        store(low, permuted);
+        store(high - lanes, permuted);
+    }
+};
+
+template <> struct avx2_ops<std::int64_t> {
+    using value_type = std::int64_t;
+    using vec = __m256i;
+    static constexpr int lanes = 4;
+
+    SIMD_PARTITION_AVX2 static vec load(const value_type *p) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    }
+    SIMD_PARTITION_AVX2 static void store(value_type *p, vec v) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+    }
+    SIMD_PARTITION_AVX2 static vec set1(value_type x) {
+        return _mm256_set1_epi64x(x);
+    }
+    SIMD_PARTITION_AVX2 static unsigned less_mask(vec v, vec pivot) {
+        return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(pivot, v)));
+    }
+    SIMD_PARTITION_AVX2 static void split(value_type *low, value_type *high,
+                                          vec v, unsigned mask) {
+        const vec permuted = _mm256_permutevar8x32_epi32(
+            v, _mm256_load_si256(
+                   reinterpret_cast<const __m256i *>(tables.lanes64[mask])));
+        store(low, permuted);
+        store(high - lanes, permuted);
+    }
+};
+
+template <> struct avx2_ops<float> {
+    using value_type = float;
+    using vec = __m256;
+    static constexpr int lanes = 8;
+
+    SIMD_PARTITION_AVX2 static vec load(const value_type *p) {
+        return _mm256_loadu_ps(p);
+    }
+    SIMD_PARTITION_AVX2 static void store(value_type *p, vec v) {
+        _mm256_storeu_ps(p, v);
+    }
+    SIMD_PARTITION_AVX2 static vec set1(value_type x) {
+        return _mm256_set1_ps(x);
+    }
+    SIMD_PARTITION_AVX2 static unsigned less_mask(vec v, vec pivot) {
+        return _mm256_movemask_ps(_mm256_cmp_ps(v, pivot, _CMP_LT_OQ));
+    }
+    SIMD_PARTITION_AVX2 static void split(value_type *low, value_type *high,
+                                          vec v, unsigned mask) {
+        const vec permuted = _mm256_permutevar8x32_ps(
+            v, _mm256_load_si256(
+                   reinterpret_cast<const __m256i *>(tables.lanes32[mask])));
+        store(low, permuted);
+        store(high - lanes, permuted);
+    }
+};
+
+template <> struct avx2_ops<double> {
+    using value_type = double;
+    using vec = __m256d;
+    static constexpr int lanes = 4;
+
+    SIMD_PARTITION_AVX2 static vec load(const value_type *p) {
+        return _mm256_loadu_pd(p);
+    }
+    SIMD_PARTITION_AVX2 static void store(value_type *p, vec v) {
+        _mm256_storeu_pd(p, v);
+    }
+    SIMD_PARTITION_AVX2 static vec set1(value_type x) {
+        return _mm256_set1_pd(x);
+    }
+    SIMD_PARTITION_AVX2 static unsigned less_mask(vec v, vec pivot) {
+        return _mm256_movemask_pd(_mm256_cmp_pd(v, pivot, _CMP_LT_OQ));
+    }
+    SIMD_PARTITION_AVX2 static void split(value_type *low, value_type *high,
+                                          vec v, unsigned mask) {
+        const vec permuted = _mm256_castsi256_pd(_mm256_permutevar8x32_epi32(
+            _mm256_castpd_si256(v),
+            _mm256_load_si256(
+                reinterpret_cast<const __m256i *>(tables.lanes64[mask]))));
+        store(low, permuted);
+        store(high - lanes, permuted);
+    }
+};
+
+template <typename T> struct avx512_ops;
+
+template <> struct avx512_ops<std::int32_t> {
+    using value_type = std::int32_t;
+    using vec = __m512i;
+    static constexpr int lanes = 16;
+
+    SIMD_PARTITION_AVX512 static vec load(const value_type *p) {
+        return _mm512_loadu_si512(p);
+    }
+    SIMD_PARTITION_AVX512 static void store(value_type *p, vec v) {
+        _mm512_storeu_si512(p, v);
+    }
+    SIMD_PARTITION_AVX512 static vec set1(value_type x) {
+        return _mm512_set1_epi32(x);
+    }
+    SIMD_PARTITION_AVX512 static unsigned less_mask(vec v, vec pivot) {
+        return _mm512_cmplt_epi32_mask(v, pivot);
+    }
+    SIMD_PARTITION_AVX512 static void split(value_type *low, value_type *high,
+                                            vec v, unsigned mask) {
+        const int n = __builtin_popcount(mask);
+        _mm512_mask_compressstoreu_epi32(low, __mmask16(mask), v);
+        _mm512_mask_compressstoreu_epi32(high - (lanes - n), __mmask16(~mask), v);
+    }
+};
+
+template <> struct avx512_ops<std::int64_t> {
+    using value_type = std::int64_t;
+    using vec = __m512i;
+    static constexpr int lanes = 8;
+
+    SIMD_PARTITION_AVX512 static vec load(const value_type *p) {
+        return _mm512_loadu_si512(p);
+    }
+    SIMD_PARTITION_AVX512 static void store(value_type *p, vec v) {
+        _mm512_storeu_si512(p, v);
+    }
+    SIMD_PARTITION_AVX512 static vec set1(value_type x) {
+        return _mm512_set1_epi64(x);
+    }
+    SIMD_PARTITION_AVX512 static unsigned less_mask(vec v, vec pivot) {
+        return _mm512_cmplt_epi64_mask(v, pivot);
+    }
+    SIMD_PARTITION_AVX512 static void split(value_type *low, value_type *high,
+                                            vec v, unsigned mask) {
+        const int n = __builtin_popcount(mask);
+        _mm512_mask_compressstoreu_epi64(low, __mmask8(mask), v);
+        _mm512_mask_compressstoreu_epi64(high - (lanes - n), __mmask8(~mask), v);
+    }
+};
+
+template <> struct avx512_ops<float> {
+    using value_type = float;
+    using vec = __m512;
+    static constexpr int lanes = 16;
+
+    SIMD_PARTITION_AVX512 static vec load(const value_type *p) {
+        return _mm512_loadu_ps(p);
+    }
+    SIMD_PARTITION_AVX512 static void store(value_type *p, vec v) {
+        _mm512_storeu_ps(p, v);
+    }
+    SIMD_PARTITION_AVX512 static vec set1(value_type x) {
+        return _mm512_set1_ps(x);
+    }
+    SIMD_PARTITION_AVX512 static unsigned less_mask(vec v, vec pivot) {
+        return _mm512_cmp_ps_mask(v, pivot, _CMP_LT_OQ);
+    }
+    SIMD_PARTITION_AVX512 static void split(value_type *low, value_type *high,
+                                            vec v, unsigned mask) {
+        const int n = __builtin_popcount(mask);
+        _mm512_mask_compressstoreu_ps(low, __mmask16(mask), v);
+        _mm512_mask_compressstoreu_ps(high - (lanes - n), __mmask16(~mask), v);
+    }
+};
+
+template <> struct avx512_ops<double> {
+    using value_type = double;
+    using vec = __m512d;
+    static constexpr int lanes = 8;
+
+    SIMD_PARTITION_AVX512 static vec load(const value_type *p) {
+        return _mm512_loadu_pd(p);
+    }
+    SIMD_PARTITION_AVX512 static void store(value_type *p, vec v) {
+        _mm512_storeu_pd(p, v);
+    }
+    SIMD_PARTITION_AVX512 static vec set1(value_type x) {
+        return _mm512_set1_pd(x);
+    }
+    SIMD_PARTITION_AVX512 static unsigned less_mask(vec v, vec pivot) {
+        return _mm512_cmp_pd_mask(v, pivot, _CMP_LT_OQ);
+    }
+    SIMD_PARTITION_AVX512 static void split(value_type *low, value_type *high,
+                                            vec v, unsigned mask) {
+        const int n = __builtin_popcount(mask);
+        _mm512_mask_compressstoreu_pd(low, __mmask8(mask), v);
+        _mm512_mask_compressstoreu_pd(high - (lanes - n), __mmask8(~mask), v);
+    }
+};
+
+// The first and the last vector are kept in registers, which leaves a
+// vector's worth of room at each end. Reading next from the end with less
+// room keeps at least a vector's worth at both, so the writes, which go to
+// both ends and may be a whole vector wide, never overwrite unread data.
+#pragma GCC diagnostic push
+// vectors are passed to and returned from the Ops functions, which would
+// change the ABI if they were real calls, but they are all inlined
+#pragma GCC diagnostic ignored "-Wpsabi"
+template <typename Ops, typename T>
+inline T *vector_partition(T *first, T *last, const T pivot) {
+    constexpr std::ptrdiff_t lanes = Ops::lanes;
+    if (last - first < 4 * lanes) {
+        return block_partition(first, last, pivot);
+    }
+    const typename Ops::vec p = Ops::set1(pivot);
+    const typename Ops::vec saved_first = Ops::load(first);
+    const typename Ops::vec saved_last = Ops::load(last - lanes);
+    // unread: [l, r); smaller elements go to [first, low), others to
+    // [high, last)
+    T *l = first + lanes, *r = last - lanes;
+    T *low = first, *high = last;
+    while (r - l >= lanes) {
+        typename Ops::vec v;
+        if (l - low <= high - r) {
+            v = Ops::load(l);
+            l += lanes;
+        } else {
+            r -= lanes;
+            v = Ops::load(r);
+        }
+        const unsigned mask = Ops::less_mask(v, p);
+        const int n = __builtin_popcount(mask);
+        Ops::split(low, high, v, mask);
+        low += n;
+        high -= lanes - n;
+    }
+
+    // what is left fills exactly the room between `low` and `high`
+    T rest[3 * lanes];
+    const std::ptrdiff_t unread = r - l;
+    std::copy(l, r, rest);
+    Ops::store(rest + unread, saved_first);
+    Ops::store(rest + unread + lanes, saved_last);
+    for (std::ptrdiff_t i = 0; i < unread + 2 * lanes; ++i) {
+        const T x = rest[i];
+        const bool less = x < pivot;
+        *low = x;
+        high[-1] = x;
+        low += less;
+        high -= !less;
+    }
+    return low;
+}
+#pragma GCC diagnostic pop
+
+template <typename T>
+__attribute__((target("avx512f"), flatten)) T *partition_avx512(T *first, T *last,
+                                                       T pivot) {
+    return vector_partition<avx512_ops<T>>(first, last, pivot);
+}
+
+template <typename T>
+__attribute__((target("avx2"), flatten)) T *partition_avx2(T *first, T *last,
+                                                           T pivot) {
+    return vector_partition<avx2_ops<T>>(first, last, pivot);
+}
+#endif
+
+template <typename T>
+struct is_key_type
+    : std::integral_constant<bool, std::is_same<T, std::int32_t>::value ||
+                                       std::is_same<T, std::int64_t>::value ||
+                                       std::is_same<T, float>::value ||
+                                       std::is_same<T, double>::value> {};
+
+// Moves the elements less than `pivot` to the front; returns the end of
+// them.
+template <typename T> T *partition_less(T *first, T *last, T pivot) {
+    static_assert(is_key_type<T>::value, "no partition kernel for this type");
+#ifdef SIMD_PARTITION_X86
+    typedef T *(*kernel_type)(T *, T *, T);
+    static const kernel_type kernel = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return &partition_avx512<T>;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return &partition_avx2<T>;
+        }
+        return &block_partition<T>;
+    }();
+    return kernel(first, last, pivot);
+#else
+    return block_partition(first, last, pivot);
+#endif
+}
+
+template <typename Iterator>
+struct is_contiguous
+    : std::integral_constant<
+          bool,
+          std::is_pointer<Iterator>::value ||
+              std::is_same<Iterator,
+                           typename std::vector<typename std::iterator_traits<
+                               Iterator>::value_type>::iterator>::value> {};
+
+template <typename Compare, typename T>
+struct is_plain_less
+    : std::integral_constant<bool,
+                             std::is_same<Compare, std::less<>>::value ||
+                                 std::is_same<Compare, std::less<T>>::value> {};
+
+// Whether partition_less can stand in for partitioning [first, last) of
+// Iterator by `comp(x, pivot)`.
+template <typename Iterator, typename Compare>
+struct applies
+    : std::integral_constant<
+          bool,
+          is_contiguous<Iterator>::value &&
+              is_key_type<
+                  typename std::iterator_traits<Iterator>::value_type>::value &&
+              is_plain_less<Compare, typename std::iterator_traits<
+                                         Iterator>::value_type>::value> {};
+
+} // namespace simd_partition
+
+#endif // end of SIMD_PARTITION_HPP
@@ -0,0 +1,231 @@
+// Partition kernels and the sorts built on them, on four kinds of input
+//
+// usage: demo_4_14 [number of elements]
+// For int32, int64, float and double keys that are sorted, reversed, random
+// or drawn from 16 distinct values, times one partition around the median
+// with std::partition, block_partition and partition_less (the kernel picked
+// for this CPU), and a full sort with std::sort, with introsort using the
+// kernels (std::less) and with introsort on a lambda, which doesn't.
+//
+// Before timing anything, every kernel this CPU can run (block_partition,
+// partition_avx2, partition_avx512) partitions inputs of every size up to
+// 200 and some larger ones, with many duplicates and, for float and double,
+// NaNs; each result must be a partition around the pivot and a permutation
+// of the input. The partitions that are timed are checked the same way.
+#include "demo_4_11.hpp"
+#include "demo_4_13.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using steady_clock = std::chrono::steady_clock;
+
+template <typename F> double time_ms(F f) {
+    auto t_start = steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(steady_clock::now() -
+                                                     t_start)
+        .count();
+}
+
+enum class input_kind { sorted, reversed, random, few_unique };
+
+const char *name(input_kind kind) {
+    switch (kind) {
+    case input_kind::sorted:
+        return "sorted";
+    case input_kind::reversed:
+        return "reversed";
+    case input_kind::random:
+        return "random";
+    default:
+        return "few unique";
+    }
+}
+
+template <typename T> bool is_nan(T x) { return x != x; }
+
+// [first, first + mid) is less than pivot, the rest isn't, and `output` holds
+// the elements of `input`
+template <typename T>
+bool is_partition_of(const std::vector<T> &input, std::vector<T> output,
+                     std::size_t mid, T pivot) {
+    if (output.size() != input.size() || mid > output.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < output.size(); ++i) {
+        if ((output[i] < pivot) != (i < mid)) {
+            return false;
+        }
+    }
+    std::vector<T> expected(input);
+    auto nan_last = [](T x, T y) { return x < y || (!is_nan(x) && is_nan(y)); };
+    std::sort(expected.begin(), expected.end(), nan_last);
+    std::sort(output.begin(), output.end(), nan_last);
+    return std::equal(
+        output.begin(), output.end(), expected.begin(),
+        [](T x, T y) { return x == y || (is_nan(x) && is_nan(y)); });
+}
+
+template <typename T> bool check_kernels(const std::string &type) {
+    using kernel_type = T *(*)(T *, T *, T);
+    std::vector<std::pair<const char *, kernel_type>> kernels = {
+        {"block", &simd_partition::block_partition<T>}};
+#ifdef SIMD_PARTITION_X86
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back({"AVX2", &simd_partition::partition_avx2<T>});
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        kernels.push_back({"AVX-512", &simd_partition::partition_avx512<T>});
+    }
+#endif
+    std::vector<std::size_t> sizes;
+    for (std::size_t n = 0; n <= 200; ++n) {
+        sizes.push_back(n);
+    }
+    for (std::size_t n : {255, 256, 257, 1000, 4099, 65536}) {
+        sizes.push_back(n);
+    }
+    std::mt19937_64 engine(7);
+    long inputs = 0;
+    bool ok = true;
+    for (std::size_t n : sizes) {
+        for (int round = 0; round < 4; ++round, ++inputs) {
+            std::vector<T> input(n);
+            for (T &x : input) {
+                x = std::numeric_limits<T>::has_quiet_NaN && engine() % 8 == 0
+                        ? std::numeric_limits<T>::quiet_NaN()
+                        : T(static_cast<int>(engine() % 41) - 20);
+            }
+            // a pivot from the input, or one below or above all of it
+            const T pivot = round == 0   ? T(-21)
+                            : round == 1 ? T(21)
+                                         : T(static_cast<int>(engine() % 41) -
+                                             20);
+            for (const auto &[name, kernel] : kernels) {
+                std::vector<T> output(input);
+                const T *mid =
+                    kernel(output.data(), output.data() + n, pivot);
+                if (!is_partition_of(input, output,
+                                     std::size_t(mid - output.data()),
+                                     pivot)) {
+                    std::cerr << name << " kernel fails for " << type
+                              << ", n = " << n << std::endl;
+                    ok = false;
+                }
+            }
+        }
+    }
+    std::cout << type << ":";
+    for (const auto &kernel : kernels) {
+        std::cout << ' ' << kernel.first;
+    }
+    std::cout << " checked on " << inputs << " inputs"
+              << (ok ? "" : ", FAILED") << std::endl;
+    return ok;
+}
+
+template <typename T> std::vector<T> make_input(input_kind kind, long n) {
+    std::mt19937_64 engine(42);
+    std::vector<T> v(n);
+    for (long i = 0; i < n; ++i) {
+        v[i] = kind == input_kind::few_unique
+                   ? T(engine() % 16)
+                   : T(static_cast<std::int64_t>(engine() % (1u << 30)));
+    }
+    if (kind == input_kind::sorted) {
+        std::sort(v.begin(), v.end());
+    } else if (kind == input_kind::reversed) {
+        std::sort(v.begin(), v.end(), std::greater<>());
+    }
+    return v;
+}
+
+template <typename T> bool run(const std::string &type, long n) {
+    bool ok = true;
+    for (input_kind kind : {input_kind::sorted, input_kind::reversed,
+                            input_kind::random, input_kind::few_unique}) {
+        const std::vector<T> input = make_input<T>(kind, n);
+        std::vector<T> sorted(input);
+        std::sort(sorted.begin(), sorted.end());
+        const T pivot = n > 0 ? sorted[n / 2] : T();
+
+        std::vector<T> a(input), b(input), c(input);
+        std::size_t a_mid = 0, b_mid = 0, c_mid = 0;
+        const double std_partition = time_ms([&] {
+            a_mid = std::partition(a.begin(), a.end(),
+                                   [&](const T &x) { return x < pivot; }) -
+                    a.begin();
+        });
+        const double block = time_ms([&] {
+            b_mid = simd_partition::block_partition(b.data(), b.data() + n,
+                                                    pivot) -
+                    b.data();
+        });
+        const double kernel = time_ms([&] {
+            c_mid = simd_partition::partition_less(c.data(), c.data() + n,
+                                                   pivot) -
+                    c.data();
+        });
+        ok = ok && is_partition_of(input, a, a_mid, pivot) &&
+             is_partition_of(input, b, b_mid, pivot) &&
+             is_partition_of(input, c, c_mid, pivot);
+
+        std::vector<T> d(input), e(input), f(input);
+        const double std_sort = time_ms([&] { std::sort(d.begin(), d.end()); });
+        const double intro_kernel =
+            time_ms([&] { introsort(e.begin(), e.end(), std::less<>()); });
+        const double intro_lambda = time_ms([&] {
+            introsort(f.begin(), f.end(),
+                      [](const T &x, const T &y) { return x < y; });
+        });
+        ok = ok && d == sorted && e == sorted && f == sorted;
+
+        std::cout << std::left << std::setw(8) << type << std::setw(12)
+                  << name(kind) << std::right << std::setw(10) << std_partition
+                  << std::setw(10) << block << std::setw(10) << kernel
+                  << std::setw(10) << std_sort << std::setw(10) << intro_kernel
+                  << std::setw(10) << intro_lambda << std::endl;
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    const long n = argc > 1 ? std::atol(argv[1]) : 4'000'000;
+    const char *kernel = "block partitioning";
+#ifdef SIMD_PARTITION_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        kernel = "AVX-512";
+    } else if (__builtin_cpu_supports("avx2")) {
+        kernel = "AVX2";
+    }
+#endif
+    bool ok = check_kernels<std::int32_t>("int32");
+    ok = check_kernels<std::int64_t>("int64") && ok;
+    ok = check_kernels<float>("float") && ok;
+    ok = check_kernels<double>("double") && ok;
+
+    std::cout << '\n'
+              << n << " elements, partition_less uses " << kernel
+              << "\n\t\t\tpartition (ms)\t\t\tsort (ms)\n"
+              << "type    input         std     block    kernel       std"
+                 "  kernels   lambda"
+              << std::fixed << std::setprecision(1) << std::endl;
+    ok = run<std::int32_t>("int32", n) && ok;
+    ok = run<std::int64_t>("int64", n) && ok;
+    ok = run<float>("float", n) && ok;
+    ok = run<double>("double", n) && ok;
+    if (!ok) {
+        std::cerr << "wrong result" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,90 @@
+// Parallel merge sort for std::list that only relinks nodes
+//
+// parallel_quicksort (Listing 4.13) is quadratic on sorted lists and starts
+// a future for every partition. parallel_list_sort instead splits the list
+// in two halves of equal length with splice, sorts the halves as tasks on
+// the thread pool of demo_4_5.hpp and merges them with std::list::merge.
+// Lists shorter than a granularity cutoff are sorted with std::list::sort,
+// itself a merge sort on spliced nodes.
+//
+// No element is copied, moved or allocated: every step relinks the nodes of
+// the original list, so references and iterators to elements stay valid.
+// Both std::list::sort and std::list::merge are stable, and so is the whole
+// sort. Every level of the recursion does O(n) work on O(log n) levels, on
+// any input.
+//
+// If comp throws, the sort waits for the tasks it started and rethrows with
+// every element still in the list, in unspecified order.
+#ifndef PARALLEL_LIST_SORT_HPP
+#define PARALLEL_LIST_SORT_HPP
+
+#include "demo_4_5.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <list>
+
+namespace list_sort_detail {
+
+// Below this length a sublist is sorted on the calling thread.
+constexpr std::size_t min_granularity = 1 << 13;
+
+template <typename T, typename Allocator, typename Compare>
+void sort(thread_pool &pool, std::list<T, Allocator> &list, Compare comp,
+          std::size_t granularity) {
+    const std::size_t size = list.size();
+    if (size <= granularity) {
+        list.sort(comp);
+        return;
+    }
+    std::list<T, Allocator> upper(list.get_allocator());
+    upper.splice(upper.begin(), list, std::next(list.begin(), size / 2),
+                 list.end());
+    std::future<void> upper_sorted = pool.submit(
+        [&pool, &upper, comp, granularity] {
+            sort(pool, upper, comp, granularity);
+        });
+    std::exception_ptr error;
+    try {
+        sort(pool, list, comp, granularity);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    // the task refers to `upper`, so it has to finish even if we throw
+    pool.wait(upper_sorted); // runs other tasks instead of blocking
+    try {
+        upper_sorted.get();
+    } catch (...) {
+        if (!error) {
+            error = std::current_exception();
+        }
+    }
+    if (!error) {
+        try {
+            // on ties the elements of `list`, the lower half, come first
+            list.merge(upper, comp);
+            return;
+        } catch (...) {
+            error = std::current_exception(); // merge leaves the rest in upper
+        }
+    }
+    list.splice(list.end(), upper);
+    std::rethrow_exception(error);
+}
+
+} // namespace list_sort_detail
+
+template <typename T, typename Allocator, typename Compare = std::less<>>
+void parallel_list_sort(thread_pool &pool, std::list<T, Allocator> &list,
+                        Compare comp = Compare()) {
+    // a few tasks per thread balance the load without tiny tasks
+    const std::size_t granularity =
+        std::max(list_sort_detail::min_granularity,
+                 list.size() / (4 * std::size_t(pool.size())));
+    list_sort_detail::sort(pool, list, comp, granularity);
+}
+
+#endif // end of PARALLEL_LIST_SORT_HPP
@@ -0,0 +1,93 @@
+// Sorting std::list: Listing 4.13 vs. std::list::sort vs. parallel_list_sort
+//
+// usage: demo_4_16 [number of elements]
+// Sorts random, sorted and reversed lists of records by a key with few
+// distinct values. Every record remembers its address and its position in
+// the input, so the program can check that no node was copied and that
+// records with equal keys kept their order. Listing 4.13 only runs on the
+// random input and a tenth of the elements: on sorted input it recurses
+// once per element.
+#include "demo_4_15.hpp"
+#include "demo_4_26.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <random>
+#include <string>
+#include <utility>
+
+using steady_clock = std::chrono::steady_clock;
+
+struct record {
+    int key;
+    long position;
+    const record *self;
+
+    bool operator<(const record &other) const { return key < other.key; }
+};
+
+std::list<record> make_input(const std::string &kind, long n) {
+    std::mt19937 engine(42);
+    std::list<record> list;
+    for (long i = 0; i < n; ++i) {
+        const int key = kind == "sorted"     ? int(i / 1000)
+                        : kind == "reversed" ? int((n - i) / 1000)
+                                             : int(engine() % 1000);
+        list.push_back({key, i, nullptr});
+        list.back().self = &list.back();
+    }
+    return list;
+}
+
+// sorted, stable, and every record still in its original node
+bool sorted_in_place(const std::list<record> &list) {
+    const record *prev = nullptr;
+    for (const record &r : list) {
+        if (r.self != &r) {
+            return false;
+        }
+        if (prev && (r.key < prev->key ||
+                     (r.key == prev->key && r.position < prev->position))) {
+            return false;
+        }
+        prev = &r;
+    }
+    return true;
+}
+
+template <typename F> long long time_ms(F f) {
+    auto t_start = steady_clock::now();
+    f();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               steady_clock::now() - t_start)
+        .count();
+}
+
+int main(int argc, char *argv[]) {
+    const long n = argc > 1 ? std::atol(argv[1]) : 2'000'000;
+    thread_pool pool;
+    std::cout << "sorting " << n << " records with " << pool.size()
+              << " threads\n"
+              << "input\t\tstd::list::sort(ms)\tparallel_list_sort(ms)"
+              << std::endl;
+    bool ok = true;
+    for (const std::string kind : {"random", "sorted", "reversed"}) {
+        std::list<record> a = make_input(kind, n), b = make_input(kind, n);
+        const long long list_ms = time_ms([&] { a.sort(); });
+        const long long parallel_ms =
+            time_ms([&] { parallel_list_sort(pool, b); });
+        const bool correct = sorted_in_place(a) && sorted_in_place(b);
+        ok = ok && correct;
+        std::cout << kind << "\t\t" << list_ms << "\t\t\t" << parallel_ms
+                  << (correct ? "" : "\tWRONG") << std::endl;
+    }
+
+    std::list<record> input = make_input("random", n / 10);
+    std::cout << "\nListing 4.13 on " << input.size()
+              << " random records: "
+              << time_ms([&] { input = async_quicksort(input); }) << "ms"
+              << std::endl;
+    return ok ? 0 : 1;
+}
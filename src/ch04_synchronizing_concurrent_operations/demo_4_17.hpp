@@ -0,0 +1,506 @@
+// Futures with continuations: then(), when_all() and when_any()
+//
+// std::future only offers get() and wait(), so whoever consumes a result has
+// to park a thread until it is ready. experimental::future follows the
+// Concurrency TS (CCIA 4.4): `f.then(g)` consumes `f` and returns a future
+// for `g(ready f)`, which runs once `f` is ready, either inline on the thread
+// that makes `f` ready or posted to an executor (anything with `post()`,
+// like the thread pool of demo_4_5.hpp). A continuation that returns a
+// future is unwrapped. when_all and when_any combine several futures into
+// one that becomes ready when all of them, or the first of them, are.
+//
+// Nothing here blocks except future::get() and future::wait().
+//
+// Inline continuations don't nest: one that makes another future ready from
+// inside a continuation is queued on its thread and runs once the current
+// one returns, so a long chain of then()s completes in constant stack depth.
+#ifndef CONTINUATION_FUTURE_HPP
+#define CONTINUATION_FUTURE_HPP
+
+#include "demo_4_5.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace experimental {
+
+template <typename T> class future;
+template <typename T> class promise;
+
+template <typename T> struct is_future : std::false_type {};
+template <typename T> struct is_future<future<T>> : std::true_type {};
+
+namespace detail {
+
+template <typename T> struct unwrapped { using type = T; };
+template <typename T> struct unwrapped<future<T>> { using type = T; };
+template <typename T> using unwrapped_t = typename unwrapped<T>::type;
+
+// Runs the continuations of a state that becomes ready. A thread that is
+// already running some queues them instead, and runs them in order after the
+// current one, which keeps the stack flat however long a chain is.
+class inline_runner {
+private:
+    inline static thread_local std::deque<function_wrapper> *pending = nullptr;
+
+public:
+    static void run(std::vector<function_wrapper> &continuations) {
+        if (pending) {
+            for (auto &continuation : continuations) {
+                pending->push_back(std::move(continuation));
+            }
+            return;
+        }
+        std::deque<function_wrapper> queue(
+            std::make_move_iterator(continuations.begin()),
+            std::make_move_iterator(continuations.end()));
+        pending = &queue;
+        struct reset {
+            ~reset() { pending = nullptr; }
+        } guard;
+        while (!queue.empty()) {
+            function_wrapper continuation = std::move(queue.front());
+            queue.pop_front();
+            continuation();
+        }
+    }
+};
+
+template <typename T> class shared_state {
+private:
+    using value_type =
+        std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+    std::mutex mtx;
+    std::condition_variable cond;
+    bool ready = false;
+    std::optional<value_type> value;
+    std::exception_ptr error;
+    // run once, then dropped: they usually own this state
+    std::vector<function_wrapper> continuations;
+
+    template <typename Store> void complete(Store store) {
+        std::vector<function_wrapper> to_run;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            if (ready) {
+                throw std::future_error(
+                    std::future_errc::promise_already_satisfied);
+            }
+            store();
+            ready = true;
+            to_run.swap(continuations);
+        }
+        cond.notify_all();
+        inline_runner::run(to_run);
+    }
+
+public:
+    template <typename... Args> void set_value(Args &&...args) {
+        complete([&] { value.emplace(std::forward<Args>(args)...); });
+    }
+
+    void set_exception(std::exception_ptr e) {
+        complete([&] { error = std::move(e); });
+    }
+
+    // Runs `continuation` as soon as the state is ready, right away if it is
+    // already.
+    void on_ready(function_wrapper continuation) {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            if (!ready) {
+                continuations.push_back(std::move(continuation));
+                return;
+            }
+        }
+        continuation();
+    }
+
+    bool is_ready() {
+        std::lock_guard<std::mutex> lk(mtx);
+        return ready;
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lk(mtx);
+        cond.wait(lk, [this] { return ready; });
+    }
+
+    value_type get() {
+        wait();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+};
+
+// Gives the combinators access to the state behind a future.
+struct access {
+    template <typename T>
+    static const std::shared_ptr<shared_state<T>> &state(const future<T> &f) {
+        return f.state;
+    }
+};
+
+// Completes `p` with the result of `f()`, or with what it throws.
+template <typename T, typename F> void fulfil(promise<T> &p, F &&f) {
+    using result_type = std::invoke_result_t<F>;
+    if constexpr (is_future<result_type>::value) {
+        result_type inner;
+        try {
+            inner = std::invoke(std::forward<F>(f));
+            if (!inner.valid()) {
+                throw std::future_error(std::future_errc::no_state);
+            }
+        } catch (...) {
+            p.set_exception(std::current_exception());
+            return;
+        }
+        inner.then([p = std::move(p)](result_type ready) mutable {
+            fulfil(p, [&ready] { return ready.get(); });
+        });
+    } else {
+        try {
+            if constexpr (std::is_void_v<result_type>) {
+                std::invoke(std::forward<F>(f));
+                p.set_value();
+            } else {
+                p.set_value(std::invoke(std::forward<F>(f)));
+            }
+        } catch (...) {
+            p.set_exception(std::current_exception());
+        }
+    }
+}
+
+} // namespace detail
+
+template <typename T> class future {
+private:
+    friend class promise<T>;
+    friend struct detail::access;
+
+    std::shared_ptr<detail::shared_state<T>> state;
+
+    explicit future(std::shared_ptr<detail::shared_state<T>> state_)
+        : state(std::move(state_)) {}
+
+    const std::shared_ptr<detail::shared_state<T>> &checked_state() const {
+        if (!state) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+        return state;
+    }
+
+    template <typename Schedule, typename F>
+    future<detail::unwrapped_t<std::invoke_result_t<F &, future<T>>>>
+    continue_with(Schedule schedule, F f) {
+        using result_type =
+            detail::unwrapped_t<std::invoke_result_t<F &, future<T>>>;
+        promise<result_type> p;
+        future<result_type> res = p.get_future();
+        std::shared_ptr<detail::shared_state<T>> s = checked_state();
+        state.reset();
+        detail::shared_state<T> *raw = s.get();
+        raw->on_ready([s = std::move(s), schedule = std::move(schedule),
+                       f = std::move(f), p = std::move(p)]() mutable {
+            schedule([s = std::move(s), f = std::move(f),
+                      p = std::move(p)]() mutable {
+                detail::fulfil(p, [&] { return f(future<T>(std::move(s))); });
+            });
+        });
+        return res;
+    }
+
+public:
+    future() noexcept = default;
+    future(future &&) noexcept = default;
+    future &operator=(future &&) noexcept = default;
+    future(const future &) = delete;
+    future &operator=(const future &) = delete;
+
+    bool valid() const noexcept { return state != nullptr; }
+
+    bool is_ready() const { return checked_state()->is_ready(); }
+
+    void wait() const { checked_state()->wait(); }
+
+    T get() {
+        std::shared_ptr<detail::shared_state<T>> s = checked_state();
+        state.reset();
+        if constexpr (std::is_void_v<T>) {
+            s->get();
+        } else {
+            return s->get();
+        }
+    }
+
+    // Runs `f(ready future)` on the thread that makes this future ready, or
+    // on the calling thread if it already is. If that thread is itself running
+    // a continuation, `f` runs after it returns, so a continuation must not
+    // wait for a future it makes ready through an inline then().
+    template <typename F> auto then(F f) {
+        return continue_with([](function_wrapper task) { task(); },
+                             std::move(f));
+    }
+
+    // Posts `f(ready future)` to `ex`, which must outlive the continuation.
+    template <typename Executor, typename F> auto then(Executor &ex, F f) {
+        return continue_with(
+            [&ex](function_wrapper task) { ex.post(std::move(task)); },
+            std::move(f));
+    }
+};
+
+template <typename T> class promise {
+private:
+    std::shared_ptr<detail::shared_state<T>> state;
+    bool future_retrieved = false;
+
+    const std::shared_ptr<detail::shared_state<T>> &checked_state() const {
+        if (!state) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+        return state;
+    }
+
+public:
+    promise() : state(std::make_shared<detail::shared_state<T>>()) {}
+
+    promise(promise &&other) noexcept
+        : state(std::move(other.state)),
+          future_retrieved(other.future_retrieved) {}
+
+    promise &operator=(promise &&other) noexcept {
+        promise(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    promise(const promise &) = delete;
+    promise &operator=(const promise &) = delete;
+
+    // An unfulfilled promise breaks its future, so continuations still run.
+    ~promise() {
+        if (state && !state->is_ready()) {
+            state->set_exception(std::make_exception_ptr(
+                std::future_error(std::future_errc::broken_promise)));
+        }
+    }
+
+    void swap(promise &other) noexcept {
+        std::swap(state, other.state);
+        std::swap(future_retrieved, other.future_retrieved);
+    }
+
+    future<T> get_future() {
+        checked_state();
+        if (future_retrieved) {
+            throw std::future_error(
+                std::future_errc::future_already_retrieved);
+        }
+        future_retrieved = true;
+        return future<T>(state);
+    }
+
+    template <typename... Args> void set_value(Args &&...args) {
+        checked_state()->set_value(std::forward<Args>(args)...);
+    }
+
+    void set_exception(std::exception_ptr e) {
+        checked_state()->set_exception(std::move(e));
+    }
+};
+
+template <typename T> future<std::decay_t<T>> make_ready_future(T &&value) {
+    promise<std::decay_t<T>> p;
+    p.set_value(std::forward<T>(value));
+    return p.get_future();
+}
+
+inline future<void> make_ready_future() {
+    promise<void> p;
+    p.set_value();
+    return p.get_future();
+}
+
+template <typename T>
+future<T> make_exceptional_future(std::exception_ptr e) {
+    promise<T> p;
+    p.set_exception(std::move(e));
+    return p.get_future();
+}
+
+// Runs `f()` on `ex` and returns a future for its (unwrapped) result.
+template <typename Executor, typename F>
+future<detail::unwrapped_t<std::invoke_result_t<F &>>> async(Executor &ex,
+                                                              F f) {
+    promise<detail::unwrapped_t<std::invoke_result_t<F &>>> p;
+    auto res = p.get_future();
+    ex.post([f = std::move(f), p = std::move(p)]() mutable {
+        detail::fulfil(p, f);
+    });
+    return res;
+}
+
+template <typename Sequence> struct when_any_result {
+    std::size_t index;
+    Sequence futures;
+};
+
+namespace detail {
+
+template <typename Sequence> struct when_all_context {
+    std::atomic<std::size_t> remaining;
+    Sequence futures;
+    promise<Sequence> p;
+
+    when_all_context(std::size_t count, Sequence futures_)
+        : remaining(count), futures(std::move(futures_)) {}
+
+    void one_ready() {
+        if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            p.set_value(std::move(futures));
+        }
+    }
+};
+
+template <typename Sequence> struct when_any_context {
+    std::atomic<bool> done{false};
+    Sequence futures;
+    promise<when_any_result<Sequence>> p;
+
+    explicit when_any_context(Sequence futures_)
+        : futures(std::move(futures_)) {}
+
+    void one_ready(std::size_t index) {
+        if (!done.exchange(true, std::memory_order_acq_rel)) {
+            p.set_value(when_any_result<Sequence>{index, std::move(futures)});
+        }
+    }
+};
+
+// The states are copied out first: a continuation that runs right away
+// moves the futures out of the context.
+template <typename Context, typename Tuple, std::size_t... I, typename Notify>
+void on_each_ready(const std::shared_ptr<Context> &ctx, const Tuple &futures,
+                   std::index_sequence<I...>, Notify notify) {
+    auto states = std::make_tuple(access::state(std::get<I>(futures))...);
+    (std::get<I>(states)->on_ready([ctx, notify] { notify(*ctx, I); }), ...);
+}
+
+template <typename Context, typename Notify>
+void on_each_ready(const std::shared_ptr<Context> &ctx, Notify notify) {
+    using future_type = typename decltype(ctx->futures)::value_type;
+    std::vector<std::decay_t<decltype(access::state(
+        std::declval<const future_type &>()))>>
+        states;
+    for (const auto &f : ctx->futures) {
+        states.push_back(access::state(f));
+    }
+    for (std::size_t i = 0; i < states.size(); ++i) {
+        states[i]->on_ready([ctx, notify, i] { notify(*ctx, i); });
+    }
+}
+
+} // namespace detail
+
+// Ready once every future is; the result holds the ready futures.
+template <typename... Futures,
+          std::enable_if_t<(is_future<std::decay_t<Futures>>::value && ...),
+                           int> = 0>
+future<std::tuple<std::decay_t<Futures>...>> when_all(Futures &&...futures) {
+    using sequence = std::tuple<std::decay_t<Futures>...>;
+    if constexpr (sizeof...(Futures) == 0) {
+        return make_ready_future(sequence());
+    } else {
+        using context = detail::when_all_context<sequence>;
+        auto ctx = std::make_shared<context>(
+            sizeof...(Futures), sequence(std::move(futures)...));
+        auto res = ctx->p.get_future();
+        detail::on_each_ready(ctx, ctx->futures,
+                              std::index_sequence_for<Futures...>(),
+                              [](context &c, std::size_t) { c.one_ready(); });
+        return res;
+    }
+}
+
+template <typename InputIt>
+future<std::vector<typename std::iterator_traits<InputIt>::value_type>>
+when_all(InputIt first, InputIt last) {
+    using sequence =
+        std::vector<typename std::iterator_traits<InputIt>::value_type>;
+    sequence futures(std::make_move_iterator(first),
+                     std::make_move_iterator(last));
+    if (futures.empty()) {
+        return make_ready_future(std::move(futures));
+    }
+    using context = detail::when_all_context<sequence>;
+    auto ctx = std::make_shared<context>(futures.size(), std::move(futures));
+    auto res = ctx->p.get_future();
+    detail::on_each_ready(ctx,
+                          [](context &c, std::size_t) { c.one_ready(); });
+    return res;
+}
+
+// Ready once any future is; the result holds all of the futures and the
+// index of the first ready one.
+template <typename... Futures,
+          std::enable_if_t<(is_future<std::decay_t<Futures>>::value && ...),
+                           int> = 0>
+future<when_any_result<std::tuple<std::decay_t<Futures>...>>>
+when_any(Futures &&...futures) {
+    using sequence = std::tuple<std::decay_t<Futures>...>;
+    if constexpr (sizeof...(Futures) == 0) {
+        return make_ready_future(
+            when_any_result<sequence>{static_cast<std::size_t>(-1), {}});
+    } else {
+        using context = detail::when_any_context<sequence>;
+        auto ctx =
+            std::make_shared<context>(sequence(std::move(futures)...));
+        auto res = ctx->p.get_future();
+        detail::on_each_ready(
+            ctx, ctx->futures, std::index_sequence_for<Futures...>(),
+            [](context &c, std::size_t index) { c.one_ready(index); });
+        return res;
+    }
+}
+
+template <typename InputIt>
+future<when_any_result<
+    std::vector<typename std::iterator_traits<InputIt>::value_type>>>
+when_any(InputIt first, InputIt last) {
+    using sequence =
+        std::vector<typename std::iterator_traits<InputIt>::value_type>;
+    sequence futures(std::make_move_iterator(first),
+                     std::make_move_iterator(last));
+    if (futures.empty()) {
+        return make_ready_future(when_any_result<sequence>{
+            static_cast<std::size_t>(-1), std::move(futures)});
+    }
+    using context = detail::when_any_context<sequence>;
+    auto ctx = std::make_shared<context>(std::move(futures));
+    auto res = ctx->p.get_future();
+    detail::on_each_ready(ctx, [](context &c, std::size_t index) {
+        c.one_ready(index);
+    });
+    return res;
+}
+
+} // namespace experimental
+
+#endif // end of CONTINUATION_FUTURE_HPP
@@ -0,0 +1,159 @@
+// Continuations instead of blocking get(): demo_4_17.hpp in action
+//
+// usage: demo_4_18 [number of elements]
+// Chains a few continuations inline and on a thread pool, then 200'000 of
+// them behind one promise, shows an exception skipping through a chain,
+// combines futures with when_all and when_any, and finally sorts a list
+// with Listing 4.13's quicksort written as a continuation graph: every
+// partition is a task on a two-thread pool, and the halves are joined by a
+// when_all continuation instead of a worker waiting on get(). Only main()
+// waits, once, for the sorted list.
+#include "demo_4_17.hpp"
+#include "demo_4_26.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+using steady_clock = std::chrono::steady_clock;
+
+// Below this length a partition is sorted by the task that owns it.
+constexpr std::size_t sequential_cutoff = 1 << 10;
+
+template <typename T>
+experimental::future<std::list<T>> continuation_quicksort(thread_pool &pool,
+                                                          std::list<T> input) {
+    if (input.size() <= sequential_cutoff) {
+        input.sort();
+        return experimental::make_ready_future(std::move(input));
+    }
+    std::list<T> result;
+    result.splice(result.begin(), input, input.begin());
+    const T &pivot = *result.begin();
+    auto divide_point = std::partition(input.begin(), input.end(),
+                                       [&](const T &t) { return t < pivot; });
+    std::list<T> lower_part;
+    lower_part.splice(lower_part.end(), input, input.begin(), divide_point);
+    auto new_lower = experimental::async(
+        pool, [&pool, lower_part = std::move(lower_part)]() mutable {
+            return continuation_quicksort(pool, std::move(lower_part));
+        });
+    auto new_higher = continuation_quicksort(pool, std::move(input));
+    return experimental::when_all(std::move(new_lower), std::move(new_higher))
+        .then([result = std::move(result)](auto parts) mutable {
+            auto [lower, higher] = parts.get();
+            result.splice(result.end(), higher.get());
+            result.splice(result.begin(), lower.get());
+            return std::move(result);
+        });
+}
+
+std::string thread_name() {
+    std::ostringstream oss;
+    oss << "thread " << std::this_thread::get_id();
+    return oss.str();
+}
+
+template <typename F> long long time_ms(F f) {
+    auto t_start = steady_clock::now();
+    f();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               steady_clock::now() - t_start)
+        .count();
+}
+
+int main(int argc, char *argv[]) {
+    const long n = argc > 1 ? std::atol(argv[1]) : 1'000'000;
+    thread_pool pool(2);
+    std::cout << "main thread: " << std::this_thread::get_id() << std::endl;
+
+    auto chain =
+        experimental::async(pool, [] { return 6; })
+            .then(pool, [](experimental::future<int> f) {
+                std::cout << "x7 on " << thread_name() << std::endl;
+                return f.get() * 7;
+            })
+            .then([](experimental::future<int> f) {
+                std::cout << "to_string inline on " << thread_name()
+                          << std::endl;
+                return std::to_string(f.get());
+            });
+    std::cout << "answer: " << chain.get() << std::endl;
+
+    auto failing =
+        experimental::async(pool,
+                            []() -> int { throw std::runtime_error("boom"); })
+            .then([](experimental::future<int> f) { return f.get() + 1; });
+    try {
+        failing.get();
+    } catch (const std::exception &e) {
+        std::cout << "exception through the chain: " << e.what()
+                  << std::endl;
+    }
+
+    // made ready at once, the whole chain completes without nesting
+    const int links = 200'000;
+    experimental::promise<int> start;
+    experimental::future<int> counted = start.get_future();
+    for (int i = 0; i < links; ++i) {
+        counted = counted.then(
+            [](experimental::future<int> f) { return f.get() + 1; });
+    }
+    start.set_value(0);
+    const int count = counted.get();
+    std::cout << links << " chained continuations counted to " << count
+              << std::endl;
+
+    std::vector<experimental::future<int>> squares;
+    for (int i = 1; i <= 4; ++i) {
+        squares.push_back(experimental::async(pool, [i] { return i * i; }));
+    }
+    auto sum = experimental::when_all(squares.begin(), squares.end())
+                   .then([](auto ready) {
+                       int total = 0;
+                       for (auto &f : ready.get()) {
+                           total += f.get();
+                       }
+                       return total;
+                   });
+    std::cout << "when_all: 1 + 4 + 9 + 16 = " << sum.get() << std::endl;
+
+    experimental::promise<std::string> never;
+    auto first = experimental::when_any(
+        never.get_future(),
+        experimental::async(pool, [] { return std::string("fast"); }));
+    auto any = first.get();
+    std::cout << "when_any: future " << any.index << " won with \""
+              << std::get<1>(any.futures).get() << '"' << std::endl;
+
+    std::mt19937 engine(42);
+    std::list<int> input;
+    for (long i = 0; i < n; ++i) {
+        input.push_back(static_cast<int>(engine()));
+    }
+    std::list<int> expected(input), by_continuations, by_async;
+    expected.sort();
+    const long long continuation_ms = time_ms([&] {
+        by_continuations = continuation_quicksort(pool, input).get();
+    });
+    std::list<int> small(input.begin(), std::next(input.begin(), n / 10));
+    const long long async_ms =
+        time_ms([&] { by_async = async_quicksort(small); });
+    small.sort();
+    const bool ok =
+        count == links && by_continuations == expected && by_async == small;
+    std::cout << "\ncontinuation quicksort of " << n << " ints on "
+              << pool.size() << " threads: " << continuation_ms << "ms\n"
+              << "Listing 4.13 on " << small.size() << " ints: " << async_ms
+              << "ms" << (ok ? "" : "\nWRONG") << std::endl;
+    return ok ? 0 : 1;
+}
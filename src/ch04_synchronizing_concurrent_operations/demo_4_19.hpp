@@ -0,0 +1,453 @@
+// C++20 coroutines on a small multithreaded scheduler (compile with
+// -std=c++20)
+//
+// A thread that waits on a condition variable, a mutex or a timer is parked
+// with its whole stack. A coroutine that waits is a heap frame of a few
+// hundred bytes, so thousands of producers and consumers can be in flight on
+// a handful of threads.
+//
+// - task<T> is lazy: it starts when awaited and resumes its awaiter when it
+//   finishes (symmetric transfer, so chains of tasks don't grow the stack).
+// - scheduler runs coroutines on a fixed set of threads. `co_await
+//   sched.schedule()` moves the caller onto it, sleep_for/sleep_until resume
+//   the caller there later, spawn() starts a task<void> that nobody awaits
+//   and sync_wait() blocks an ordinary thread until a task is done.
+// - async_queue<T>, a threadsafe_queue (Listing 4.5) whose pop() is
+//   awaited, and async_mutex::lock() suspend the caller instead of blocking
+//   its thread; the push or unlock that satisfies a waiter schedules it
+//   again.
+#ifndef CORO_SCHEDULER_HPP
+#define CORO_SCHEDULER_HPP
+
+#include "listing_4_5.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace coro {
+
+template <typename T = void> class task;
+
+namespace detail {
+
+// Resumes whoever awaited the finished task, if anybody did.
+struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+
+    template <typename Promise>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<Promise> h) noexcept {
+        std::coroutine_handle<> continuation = h.promise().continuation;
+        return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+};
+
+struct promise_base {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template <typename T> struct task_promise : promise_base {
+    std::optional<T> value;
+
+    task<T> get_return_object() noexcept;
+
+    template <typename U> void return_value(U &&v) {
+        value.emplace(std::forward<U>(v));
+    }
+
+    T result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+};
+
+template <> struct task_promise<void> : promise_base {
+    task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+// A coroutine that starts right away and frees itself when it is done.
+struct detached {
+    struct promise_type {
+        detached get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+} // namespace detail
+
+template <typename T> class [[nodiscard]] task {
+public:
+    using promise_type = detail::task_promise<T>;
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+public:
+    task() noexcept = default;
+    explicit task(std::coroutine_handle<promise_type> h) noexcept
+        : handle(h) {}
+
+    task(task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+
+    task &operator=(task &&other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, {});
+        }
+        return *this;
+    }
+
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+
+    ~task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    // Starts the task and suspends the awaiter until it finishes.
+    auto operator co_await() && noexcept {
+        struct awaiter {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() noexcept { return handle.done(); }
+
+            std::coroutine_handle<>
+            await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+
+            T await_resume() { return handle.promise().result(); }
+        };
+        return awaiter{handle};
+    }
+};
+
+namespace detail {
+
+template <typename T> task<T> task_promise<T>::get_return_object() noexcept {
+    return task<T>(std::coroutine_handle<task_promise>::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object() noexcept {
+    return task<void>(std::coroutine_handle<task_promise>::from_promise(*this));
+}
+
+} // namespace detail
+
+class scheduler {
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct timer {
+        clock::time_point when;
+        std::coroutine_handle<> handle;
+
+        bool operator>(const timer &other) const { return when > other.when; }
+    };
+
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::deque<std::coroutine_handle<>> ready;
+    std::priority_queue<timer, std::vector<timer>, std::greater<>> timers;
+    bool done = false;
+    std::vector<std::thread> threads;
+
+    // Workers also fire timers: whoever is idle sleeps until the earliest
+    // deadline.
+    void worker_thread() {
+        std::unique_lock<std::mutex> lk(mtx);
+        while (true) {
+            const clock::time_point now = clock::now();
+            while (!timers.empty() && timers.top().when <= now) {
+                ready.push_back(timers.top().handle);
+                timers.pop();
+            }
+            if (!ready.empty()) {
+                std::coroutine_handle<> h = ready.front();
+                ready.pop_front();
+                lk.unlock();
+                h.resume();
+                lk.lock();
+            } else if (done) {
+                return;
+            } else if (timers.empty()) {
+                cond.wait(lk);
+            } else {
+                cond.wait_until(lk, timers.top().when);
+            }
+        }
+    }
+
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            done = true;
+        }
+        cond.notify_all();
+        for (auto &thread : threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+
+public:
+    explicit scheduler(
+        unsigned thread_count = std::thread::hardware_concurrency()) {
+        thread_count = std::max(thread_count, 1u);
+        try {
+            for (unsigned i = 0; i < thread_count; ++i) {
+                threads.emplace_back(&scheduler::worker_thread, this);
+            }
+        } catch (...) {
+            shutdown();
+            throw;
+        }
+    }
+
+    scheduler(const scheduler &) = delete;
+    scheduler &operator=(const scheduler &) = delete;
+
+    // Runs everything that is ready; coroutines still asleep or waiting on
+    // a queue or a mutex are never resumed.
+    ~scheduler() { shutdown(); }
+
+    unsigned size() const { return static_cast<unsigned>(threads.size()); }
+
+    void post(std::coroutine_handle<> h) {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            ready.push_back(h);
+        }
+        cond.notify_one();
+    }
+
+    // `co_await sched.schedule()` continues on one of the scheduler's
+    // threads.
+    auto schedule() noexcept {
+        struct awaiter {
+            scheduler &sched;
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> h) { sched.post(h); }
+            void await_resume() noexcept {}
+        };
+        return awaiter{*this};
+    }
+
+    auto sleep_until(clock::time_point when) noexcept {
+        struct awaiter {
+            scheduler &sched;
+            clock::time_point when;
+
+            bool await_ready() noexcept { return false; }
+
+            void await_suspend(std::coroutine_handle<> h) {
+                bool earliest;
+                {
+                    std::lock_guard<std::mutex> lk(sched.mtx);
+                    earliest =
+                        sched.timers.empty() || when < sched.timers.top().when;
+                    sched.timers.push({when, h});
+                }
+                if (earliest) {
+                    sched.cond.notify_one();
+                }
+            }
+
+            void await_resume() noexcept {}
+        };
+        return awaiter{*this, when};
+    }
+
+    template <typename Rep, typename Period>
+    auto sleep_for(const std::chrono::duration<Rep, Period> &duration) {
+        return sleep_until(
+            clock::now() +
+            std::chrono::duration_cast<clock::duration>(duration));
+    }
+
+    // Starts `t` on this scheduler; an exception escaping it terminates.
+    void spawn(task<void> t) { run_detached(*this, std::move(t)); }
+
+private:
+    static detail::detached run_detached(scheduler &sched, task<void> t) {
+        co_await sched.schedule();
+        co_await std::move(t);
+    }
+};
+
+// Blocks the calling thread, which must not be one of a scheduler's, until
+// `t` has finished, and returns its result.
+template <typename T> T sync_wait(task<T> t) {
+    std::promise<T> result;
+    std::future<T> f = result.get_future();
+    [](task<T> t, std::promise<T> result) -> detail::detached {
+        try {
+            if constexpr (std::is_void_v<T>) {
+                co_await std::move(t);
+                result.set_value();
+            } else {
+                result.set_value(co_await std::move(t));
+            }
+        } catch (...) {
+            result.set_exception(std::current_exception());
+        }
+    }(std::move(t), std::move(result));
+    return f.get();
+}
+
+// threadsafe_queue (Listing 4.5) with an awaitable pop: `co_await q.pop()`
+// suspends until a value is available. The awaiter waits in the queue as an
+// async_waiter, so a value pushed while consumers wait goes straight to the
+// longest waiting one, which resumes on the scheduler.
+template <typename T> class async_queue {
+private:
+    using queue_type = threadsafe_queue<T>;
+
+    struct pop_awaiter : queue_type::async_waiter {
+        async_queue &queue;
+        std::coroutine_handle<> handle;
+
+        explicit pop_awaiter(async_queue &queue_) : queue(queue_) {}
+
+        bool await_ready() noexcept { return false; }
+
+        // once queued, a push on another thread may resume the coroutine
+        // and destroy this awaiter before try_pop_or_wait() returns
+        bool await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            return !queue.data.try_pop_or_wait(*this);
+        }
+
+        void ready() override { queue.sched.post(handle); }
+
+        T await_resume() { return std::move(*this->value); }
+    };
+
+    scheduler &sched;
+    queue_type data;
+
+public:
+    explicit async_queue(scheduler &sched_) : sched(sched_) {}
+
+    async_queue(const async_queue &) = delete;
+    async_queue &operator=(const async_queue &) = delete;
+
+    void push(T new_value) { data.push(std::move(new_value)); }
+
+    [[nodiscard]] pop_awaiter pop() { return pop_awaiter{*this}; }
+
+    std::optional<T> try_pop() { return data.try_pop_value(); }
+
+    bool empty() const { return data.empty(); }
+};
+
+// A mutex whose lock() is awaited. unlock() hands the mutex directly to the
+// longest waiting coroutine and schedules it, so waiters are served in FIFO
+// order and never spin.
+class async_mutex {
+private:
+    struct lock_awaiter {
+        async_mutex &mutex;
+
+        bool await_ready() noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> h) {
+            std::lock_guard<std::mutex> lk(mutex.mtx);
+            if (!mutex.locked) {
+                mutex.locked = true;
+                return false;
+            }
+            mutex.waiters.push_back(h);
+            return true;
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    struct scoped_lock_awaiter : lock_awaiter {
+        std::unique_lock<async_mutex> await_resume() noexcept {
+            return std::unique_lock<async_mutex>(this->mutex, std::adopt_lock);
+        }
+    };
+
+    scheduler &sched;
+    std::mutex mtx;
+    bool locked = false;
+    std::deque<std::coroutine_handle<>> waiters;
+
+public:
+    explicit async_mutex(scheduler &sched_) : sched(sched_) {}
+
+    async_mutex(const async_mutex &) = delete;
+    async_mutex &operator=(const async_mutex &) = delete;
+
+    // `co_await m.lock()`; pair it with unlock().
+    [[nodiscard]] lock_awaiter lock() { return lock_awaiter{*this}; }
+
+    // `auto lk = co_await m.scoped_lock()` unlocks when `lk` goes away.
+    [[nodiscard]] scoped_lock_awaiter scoped_lock() {
+        return scoped_lock_awaiter{{*this}};
+    }
+
+    bool try_lock() {
+        std::lock_guard<std::mutex> lk(mtx);
+        return !std::exchange(locked, true);
+    }
+
+    void unlock() {
+        std::coroutine_handle<> next;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            if (waiters.empty()) {
+                locked = false;
+                return;
+            }
+            next = waiters.front();
+            waiters.pop_front();
+        }
+        sched.post(next);
+    }
+};
+
+} // namespace coro
+
+#endif // end of CORO_SCHEDULER_HPP
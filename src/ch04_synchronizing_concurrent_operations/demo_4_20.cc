@@ -0,0 +1,210 @@
+// Listing 4.1 and demo_4_1.cc as coroutines, and 100k producers and
+// consumers on a few threads (compile with -std=c++20)
+//
+// usage: demo_4_20 [coroutine pairs] [thread pairs] [items per pair]
+// First replays the data_preparation/data_processing flow of Listing 4.1 with
+// an awaitable queue and timer, the std::async calls of demo_4_1.cc with
+// tasks, and a counter guarded by an async_mutex. Then every pair of a
+// producer and a consumer exchanges a few items through its own queue: as
+// coroutines on a scheduler (50000 pairs, 100000 coroutines, by default) and
+// as one thread per role on threadsafe_queue (500 pairs, 1000 threads).
+#include "demo_4_19.hpp"
+#include "listing_4_5.hpp"
+#include <sys/resource.h>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <latch>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using steady_clock = std::chrono::steady_clock;
+
+struct data_chunk {
+    int id;
+    bool last;
+
+    data_chunk(int id_) : id(id_), last(false) {}
+};
+
+coro::task<data_chunk> prepare_data(coro::scheduler &sched) {
+    // preparing... without holding on to a thread
+    co_await sched.sleep_for(std::chrono::milliseconds(rand() % 100));
+    co_return data_chunk(rand());
+}
+
+coro::task<> data_preparation(coro::scheduler &sched,
+                              coro::async_queue<data_chunk> &data_queue) {
+    const int num = 10;
+    for (int i = 0; i < num; ++i) {
+        data_chunk data = co_await prepare_data(sched);
+        if (i == num - 1) {
+            data.last = true;
+        }
+        data_queue.push(data);
+    }
+}
+
+coro::task<> data_processing(coro::async_queue<data_chunk> &data_queue,
+                             std::latch &done) {
+    while (true) {
+        data_chunk data = co_await data_queue.pop();
+        std::cout << "processed data_chunk: " << data.id << std::endl;
+        if (data.last) {
+            break;
+        }
+    }
+    done.count_down();
+}
+
+coro::task<std::string> f(coro::scheduler &sched) {
+    co_await sched.schedule();
+    std::ostringstream oss;
+    oss << "thread " << std::this_thread::get_id();
+    co_return oss.str();
+}
+
+coro::task<> increment(coro::async_mutex &mtx, long &counter, int times,
+                       std::latch &done) {
+    for (int i = 0; i < times; ++i) {
+        auto lk = co_await mtx.scoped_lock();
+        ++counter;
+    }
+    done.count_down();
+}
+
+coro::task<> producer(coro::async_queue<int> &queue, int items) {
+    for (int i = 0; i < items; ++i) {
+        queue.push(i);
+    }
+    queue.push(-1);
+    co_return;
+}
+
+coro::task<> consumer(coro::async_queue<int> &queue, long &sum,
+                      std::latch &done) {
+    for (int item; (item = co_await queue.pop()) >= 0;) {
+        sum += item;
+    }
+    done.count_down();
+}
+
+long peak_rss_kb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+template <typename F> double time_ms(F f) {
+    auto t_start = steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(steady_clock::now() -
+                                                     t_start)
+        .count();
+}
+
+int main(int argc, char *argv[]) {
+    const int coroutine_pairs = argc > 1 ? std::atoi(argv[1]) : 50'000;
+    const int thread_pairs = argc > 2 ? std::atoi(argv[2]) : 500;
+    const int items = argc > 3 ? std::atoi(argv[3]) : 10;
+    const long expected_sum = long(items) * (items - 1) / 2;
+    coro::scheduler sched;
+
+    {
+        coro::async_queue<data_chunk> data_queue(sched);
+        std::latch done(1);
+        sched.spawn(data_processing(data_queue, done));
+        sched.spawn(data_preparation(sched, data_queue));
+        done.wait();
+    }
+
+    std::cout << "\nmain thread: " << std::this_thread::get_id() << std::endl;
+    for (int i = 0; i < 4; ++i) {
+        std::cout << "f" << i + 1 << " runs in "
+                  << coro::sync_wait(f(sched)) << std::endl;
+    }
+
+    {
+        coro::async_mutex mtx(sched);
+        long counter = 0;
+        const int coroutines = 100, times = 1000;
+        std::latch done(coroutines);
+        for (int i = 0; i < coroutines; ++i) {
+            sched.spawn(increment(mtx, counter, times, done));
+        }
+        done.wait();
+        std::cout << "\nasync_mutex counter: " << counter << " (expected "
+                  << coroutines * times << ")" << std::endl;
+    }
+
+    bool ok = true;
+    std::cout << "\npairs exchanging " << items << " items each\n"
+              << "design\t\t\tpairs\tthreads\ttime(ms)\tns/item\tpeak RSS "
+                 "growth(KiB)"
+              << std::endl;
+    {
+        std::vector<std::unique_ptr<coro::async_queue<int>>> queues;
+        std::vector<long> sums(coroutine_pairs);
+        const long rss_before = peak_rss_kb();
+        std::latch done(coroutine_pairs);
+        const double ms = time_ms([&] {
+            for (int i = 0; i < coroutine_pairs; ++i) {
+                queues.push_back(std::make_unique<coro::async_queue<int>>(sched));
+                sched.spawn(consumer(*queues.back(), sums[i], done));
+            }
+            for (int i = 0; i < coroutine_pairs; ++i) {
+                sched.spawn(producer(*queues[i], items));
+            }
+            done.wait();
+        });
+        for (long sum : sums) {
+            ok = ok && sum == expected_sum;
+        }
+        std::cout << "coroutines\t\t" << coroutine_pairs << '\t' << sched.size()
+                  << '\t' << ms << "\t\t"
+                  << ms * 1e6 / (double(coroutine_pairs) * (items + 1)) << '\t'
+                  << peak_rss_kb() - rss_before << std::endl;
+    }
+    {
+        std::vector<std::unique_ptr<threadsafe_queue<int>>> queues;
+        std::vector<long> sums(thread_pairs);
+        std::vector<std::thread> threads;
+        const long rss_before = peak_rss_kb();
+        const double ms = time_ms([&] {
+            for (int i = 0; i < thread_pairs; ++i) {
+                queues.push_back(std::make_unique<threadsafe_queue<int>>());
+                threads.emplace_back([&queue = *queues.back(), &sum = sums[i]] {
+                    for (int item; (item = queue.wait_and_pop_value()) >= 0;) {
+                        sum += item;
+                    }
+                });
+            }
+            for (int i = 0; i < thread_pairs; ++i) {
+                threads.emplace_back([&queue = *queues[i], items] {
+                    for (int i = 0; i < items; ++i) {
+                        queue.push(i);
+                    }
+                    queue.push(-1);
+                });
+            }
+            for (auto &thread : threads) {
+                thread.join();
+            }
+        });
+        for (long sum : sums) {
+            ok = ok && sum == expected_sum;
+        }
+        std::cout << "thread per role\t\t" << thread_pairs << '\t'
+                  << 2 * thread_pairs << '\t' << ms << "\t\t"
+                  << ms * 1e6 / (double(thread_pairs) * (items + 1)) << '\t'
+                  << peak_rss_kb() - rss_before << std::endl;
+    }
+    if (!ok) {
+        std::cerr << "wrong sums" << std::endl;
+        return 1;
+    }
+}
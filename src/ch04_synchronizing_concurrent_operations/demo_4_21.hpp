@@ -0,0 +1,171 @@
+// std::async with an executor and a process-wide concurrency cap
+//
+// With the default launch policy std::async decides on its own whether a
+// task gets a new thread or is deferred until get(), and recursive callers
+// like Listing 4.13 end up with hundreds of threads or none at all.
+// async_limit::async(ex, f, args...) instead hands the task to an executor
+// (anything with `post()`: the thread pool of demo_4_5.hpp, or
+// new_thread_executor below) as long as fewer than max_concurrency() tasks
+// started this way are running, and otherwise runs it on the calling thread
+// before returning. A task is never deferred, and stats() reports how many
+// ran each way.
+#ifndef ASYNC_LIMIT_HPP
+#define ASYNC_LIMIT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace async_limit {
+
+struct statistics {
+    unsigned long long offloaded;
+    unsigned long long ran_inline;
+    unsigned peak_in_flight;
+};
+
+namespace detail {
+
+class limiter {
+private:
+    std::atomic<unsigned> max_in_flight{
+        std::max(std::thread::hardware_concurrency(), 1u)};
+    std::atomic<unsigned> in_flight{0};
+    std::atomic<unsigned> peak{0};
+    std::atomic<unsigned long long> offloaded{0};
+    std::atomic<unsigned long long> ran_inline{0};
+
+public:
+    // Takes a slot if one is free.
+    bool try_acquire() {
+        unsigned current = in_flight.load(std::memory_order_relaxed);
+        do {
+            if (current >= max_in_flight.load(std::memory_order_relaxed)) {
+                ran_inline.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        } while (!in_flight.compare_exchange_weak(current, current + 1,
+                                                  std::memory_order_relaxed));
+        unsigned highest = peak.load(std::memory_order_relaxed);
+        while (current + 1 > highest &&
+               !peak.compare_exchange_weak(highest, current + 1,
+                                           std::memory_order_relaxed)) {
+        }
+        offloaded.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void release() { in_flight.fetch_sub(1, std::memory_order_relaxed); }
+
+    void set_max(unsigned n) {
+        max_in_flight.store(n, std::memory_order_relaxed);
+    }
+
+    unsigned max() const {
+        return max_in_flight.load(std::memory_order_relaxed);
+    }
+
+    statistics stats() const {
+        return {offloaded.load(std::memory_order_relaxed),
+                ran_inline.load(std::memory_order_relaxed),
+                peak.load(std::memory_order_relaxed)};
+    }
+
+    void reset_stats() {
+        offloaded.store(0, std::memory_order_relaxed);
+        ran_inline.store(0, std::memory_order_relaxed);
+        peak.store(in_flight.load(std::memory_order_relaxed),
+                   std::memory_order_relaxed);
+    }
+};
+
+inline limiter &global_limiter() {
+    static limiter instance;
+    return instance;
+}
+
+} // namespace detail
+
+// At most `n` tasks run on executors at a time, 0 runs everything inline.
+// The default is std::thread::hardware_concurrency().
+inline void set_max_concurrency(unsigned n) {
+    detail::global_limiter().set_max(n);
+}
+
+inline unsigned max_concurrency() { return detail::global_limiter().max(); }
+
+inline statistics stats() { return detail::global_limiter().stats(); }
+
+inline void reset_stats() { detail::global_limiter().reset_stats(); }
+
+// Starts every task on a thread of its own, like std::launch::async; the
+// cap keeps the number of those threads in check.
+class new_thread_executor {
+public:
+    template <typename FunctionType> void post(FunctionType f) {
+        std::thread(std::move(f)).detach();
+    }
+};
+
+template <typename Executor, typename F, typename... Args>
+std::future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>>
+async(Executor &ex, F &&f, Args &&...args) {
+    using result_type =
+        std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+    auto bound = [f = std::decay_t<F>(std::forward<F>(f)),
+                  args = std::tuple<std::decay_t<Args>...>(
+                      std::forward<Args>(args)...)]() mutable -> result_type {
+        return std::apply(std::move(f), std::move(args));
+    };
+    detail::limiter &limiter = detail::global_limiter();
+    if (!limiter.try_acquire()) {
+        std::packaged_task<result_type()> task(std::move(bound));
+        std::future<result_type> res = task.get_future();
+        task();
+        return res;
+    }
+
+    std::promise<result_type> p;
+    std::future<result_type> res = p.get_future();
+    try {
+        // the slot is free again by the time the future is ready
+        ex.post([&limiter, bound = std::move(bound),
+                 p = std::move(p)]() mutable {
+            std::exception_ptr error;
+            if constexpr (std::is_void_v<result_type>) {
+                try {
+                    bound();
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                limiter.release();
+                error ? p.set_exception(error) : p.set_value();
+            } else {
+                std::optional<result_type> value;
+                try {
+                    value.emplace(bound());
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                limiter.release();
+                error ? p.set_exception(error)
+                      : p.set_value(std::move(*value));
+            }
+        });
+    } catch (...) {
+        limiter.release();
+        throw;
+    }
+    return res;
+}
+
+} // namespace async_limit
+
+#endif // end of ASYNC_LIMIT_HPP
@@ -0,0 +1,167 @@
+// Listing 4.13 with std::async vs. async_limit::async
+//
+// usage: demo_4_22 [number of elements]
+// First runs the four calls of demo_4_1.cc through async_limit::async with a
+// cap of two, then sorts a list with Listing 4.13's quicksort using
+// std::async (default and std::launch::async policy) and async_limit::async
+// on a thread per task and on the thread pool of demo_4_5.hpp. A sampler
+// thread records the highest number of threads the process had.
+#include "demo_4_21.hpp"
+#include "demo_4_5.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <list>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+using steady_clock = std::chrono::steady_clock;
+
+std::string f() {
+    std::ostringstream oss;
+    oss << "thread " << std::this_thread::get_id();
+    return oss.str();
+}
+
+// Listing 4.13 with the call that starts the lower half, and the wait for
+// it, left to `spawner`
+template <typename T, typename Spawner>
+std::list<T> quicksort(std::list<T> input, Spawner &spawner) {
+    if (input.empty()) {
+        return input;
+    }
+    std::list<T> result;
+    result.splice(result.begin(), input, input.begin());
+    const T &pivot = *result.begin();
+    auto divide_point = std::partition(input.begin(), input.end(),
+                                       [&](const T &t) { return t < pivot; });
+    std::list<T> lower_part;
+    lower_part.splice(lower_part.end(), input, input.begin(), divide_point);
+    std::future<std::list<T>> new_lower(spawner.spawn(std::move(lower_part)));
+    auto new_higher(quicksort(std::move(input), spawner));
+    result.splice(result.end(), new_higher);
+    spawner.wait(new_lower);
+    result.splice(result.begin(), new_lower.get());
+    return result;
+}
+
+struct std_async {
+    std::launch policy;
+
+    std::future<std::list<int>> spawn(std::list<int> part) {
+        return std::async(policy, &quicksort<int, std_async>, std::move(part),
+                          std::ref(*this));
+    }
+
+    void wait(const std::future<std::list<int>> &) {}
+};
+
+template <typename Executor> struct limited_async {
+    Executor &ex;
+
+    std::future<std::list<int>> spawn(std::list<int> part) {
+        return async_limit::async(ex, &quicksort<int, limited_async>,
+                                  std::move(part), std::ref(*this));
+    }
+
+    // a pool worker that waits for its lower half runs other tasks meanwhile
+    void wait(const std::future<std::list<int>> &f) {
+        if constexpr (std::is_same_v<Executor, thread_pool>) {
+            ex.wait(f);
+        }
+    }
+};
+
+unsigned current_threads() {
+    std::ifstream status("/proc/self/status");
+    for (std::string line; std::getline(status, line);) {
+        if (line.compare(0, 8, "Threads:") == 0) {
+            return static_cast<unsigned>(std::stoul(line.substr(8)));
+        }
+    }
+    return 0;
+}
+
+template <typename F> void run(const std::string &name, F sort) {
+    std::atomic_bool done(false);
+    std::atomic<unsigned> peak_threads(0);
+    std::thread sampler([&] {
+        while (!done) {
+            peak_threads = std::max(peak_threads.load(), current_threads());
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+    async_limit::reset_stats();
+    auto t_start = steady_clock::now();
+    const bool ok = sort();
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        steady_clock::now() - t_start)
+                        .count();
+    done = true;
+    sampler.join();
+    const async_limit::statistics stats = async_limit::stats();
+    std::cout << name << '\t' << ms << "\t\t" << peak_threads << "\t\t"
+              << stats.offloaded << '\t' << stats.ran_inline
+              << (ok ? "" : "\tWRONG") << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    const long n = argc > 1 ? std::atol(argv[1]) : 20'000;
+
+    async_limit::set_max_concurrency(2);
+    async_limit::new_thread_executor new_thread;
+    std::cout << "main thread: " << std::this_thread::get_id()
+              << "\ncap: " << async_limit::max_concurrency() << std::endl;
+    {
+        auto f1 = async_limit::async(new_thread, f);
+        auto f2 = async_limit::async(new_thread, f);
+        auto f3 = async_limit::async(new_thread, f);
+        auto f4 = async_limit::async(new_thread, f);
+        std::cout << "f1 runs in " << f1.get() << "\nf2 runs in " << f2.get()
+                  << "\nf3 runs in " << f3.get() << "\nf4 runs in "
+                  << f4.get() << std::endl;
+        const async_limit::statistics stats = async_limit::stats();
+        std::cout << stats.offloaded << " offloaded, " << stats.ran_inline
+                  << " inline" << std::endl;
+    }
+
+    std::mt19937 engine(42);
+    std::list<int> input;
+    for (long i = 0; i < n; ++i) {
+        input.push_back(static_cast<int>(engine()));
+    }
+    std::list<int> expected(input);
+    expected.sort();
+
+    async_limit::set_max_concurrency(
+        std::max(std::thread::hardware_concurrency(), 2u));
+    std::cout << "\nsorting " << n << " ints, cap "
+              << async_limit::max_concurrency()
+              << "\nspawn\t\t\ttime(ms)\tpeak threads\toffloaded\tinline"
+              << std::endl;
+    run("std::async\t", [&] {
+        std_async spawner{std::launch::async | std::launch::deferred};
+        return quicksort(input, spawner) == expected;
+    });
+    run("std::launch::async", [&] {
+        std_async spawner{std::launch::async};
+        return quicksort(input, spawner) == expected;
+    });
+    run("async, new threads", [&] {
+        limited_async<async_limit::new_thread_executor> spawner{new_thread};
+        return quicksort(input, spawner) == expected;
+    });
+    run("async, thread pool", [&] {
+        thread_pool pool(async_limit::max_concurrency());
+        limited_async<thread_pool> spawner{pool};
+        return quicksort(input, spawner) == expected;
+    });
+}
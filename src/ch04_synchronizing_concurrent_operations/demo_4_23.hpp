@@ -0,0 +1,465 @@
+// A multi-stage pipeline with bounded queues and backpressure
+//
+// Listing 4.1 hands data_chunks from one thread to another through an
+// unbounded std::queue and marks the last one with a flag. Here a pipeline
+// is a source, any number of stages and a sink, built as
+//
+//     auto p = pipeline::from("read", [&]() -> std::optional<chunk> {...})
+//                  .then("parse", parse, {4, 256})
+//                  .sink("store", store);
+//     p.run();
+//
+// Every stage after the source owns a bounded_mpmc_queue (demo_4_7.hpp) and
+// `parallelism` worker threads. When its queue is full, the upstream thread
+// either blocks (overflow::block, the default) or drops the item
+// (overflow::shed), so memory stays bounded when a stage falls behind. A
+// stage function returning std::optional filters: an empty result is not
+// passed on. An `ordered` stage passes results on in the order it accepted
+// its inputs, however its workers finish; it accepts at most capacity +
+// parallelism items ahead of the oldest one it hasn't passed on, so the
+// results waiting for their turn are bounded as well. The source ends the stream by
+// returning std::nullopt; each stage passes the end on once all of its
+// workers are done, and run() returns when the sink is. metrics() reports
+// throughput and queue depth per stage, also while the pipeline runs.
+//
+// Items must be nothrow move constructible (a bounded_mpmc_queue
+// requirement). A stage function that throws loses that item, which is
+// counted as failed.
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include "demo_4_7.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace pipeline {
+
+enum class overflow { block, shed };
+
+struct stage_options {
+    unsigned parallelism = 1;
+    std::size_t capacity = 64;
+    overflow on_overflow = overflow::block;
+    // results leave in input order; no effect on sinks
+    bool ordered = false;
+};
+
+struct stage_metrics {
+    std::string name;
+    unsigned long long processed; // items handled (produced, for the source)
+    unsigned long long emitted;   // items passed to the next stage
+    unsigned long long shed;      // items dropped because the queue was full
+    unsigned long long failed;    // items whose stage function threw
+    std::size_t queue_depth;
+    std::size_t peak_queue_depth;
+    std::size_t capacity;
+    double items_per_second; // processed, since the pipeline started
+};
+
+class pipeline;
+template <typename T> class builder;
+
+namespace detail {
+
+using clock = std::chrono::steady_clock;
+
+template <typename T> struct filter_result {
+    using type = T;
+    static constexpr bool filters = false;
+};
+
+template <typename T> struct filter_result<std::optional<T>> {
+    using type = T;
+    static constexpr bool filters = true;
+};
+
+template <typename T> class inlet {
+public:
+    virtual ~inlet() = default;
+    // false if the item was shed
+    virtual bool offer(T value) = 0;
+    // called once, after the last offer()
+    virtual void end_of_stream() = 0;
+};
+
+class stage_base {
+protected:
+    const std::string name;
+    std::vector<std::thread> threads;
+    std::atomic<unsigned long long> processed{0};
+    std::atomic<unsigned long long> emitted{0};
+    std::atomic<unsigned long long> shed{0};
+    std::atomic<unsigned long long> failed{0};
+    std::atomic<std::size_t> peak_depth{0};
+    clock::time_point started;
+    std::atomic<clock::rep> finished{0}; // 0 while running
+
+    void record_depth(std::size_t current) {
+        std::size_t peak = peak_depth.load(std::memory_order_relaxed);
+        while (current > peak &&
+               !peak_depth.compare_exchange_weak(peak, current,
+                                                 std::memory_order_relaxed)) {
+        }
+    }
+
+    void mark_finished() {
+        finished.store(clock::now().time_since_epoch().count(),
+                       std::memory_order_relaxed);
+    }
+
+    virtual void launch() = 0;
+    virtual std::size_t capacity() const { return 0; }
+    virtual std::size_t queue_depth() const { return 0; }
+
+public:
+    explicit stage_base(std::string name_) : name(std::move(name_)) {}
+
+    stage_base(const stage_base &) = delete;
+    stage_base &operator=(const stage_base &) = delete;
+
+    virtual ~stage_base() = default;
+
+    void start() {
+        started = clock::now();
+        launch();
+    }
+
+    void join() {
+        for (auto &thread : threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+
+    stage_metrics metrics() const {
+        const clock::rep end = finished.load(std::memory_order_relaxed);
+        const clock::time_point until =
+            end ? clock::time_point(clock::duration(end)) : clock::now();
+        const double seconds =
+            std::chrono::duration<double>(until - started).count();
+        const unsigned long long count =
+            processed.load(std::memory_order_relaxed);
+        return {name,
+                count,
+                emitted.load(std::memory_order_relaxed),
+                shed.load(std::memory_order_relaxed),
+                failed.load(std::memory_order_relaxed),
+                queue_depth(),
+                peak_depth.load(std::memory_order_relaxed),
+                capacity(),
+                seconds > 0 ? count / seconds : 0.0};
+    }
+};
+
+template <typename Out, typename Generator>
+class source_stage : public stage_base {
+private:
+    Generator generate;
+    inlet<Out> *downstream = nullptr;
+
+    template <typename T> friend class ::pipeline::builder;
+
+    void launch() override {
+        threads.emplace_back([this] {
+            while (std::optional<Out> value = generate()) {
+                processed.fetch_add(1, std::memory_order_relaxed);
+                if (downstream->offer(std::move(*value))) {
+                    emitted.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            mark_finished();
+            downstream->end_of_stream();
+        });
+    }
+
+public:
+    source_stage(std::string name_, Generator generate_)
+        : stage_base(std::move(name_)), generate(std::move(generate_)) {}
+};
+
+// Out is void for the sink.
+template <typename In, typename Out, typename F>
+class worker_stage : public stage_base, public inlet<In> {
+private:
+    struct message {
+        std::uint64_t seq;
+        std::optional<In> value; // empty: end of stream
+    };
+
+    using output = std::conditional_t<std::is_void_v<Out>, int, Out>;
+
+    F fn;
+    const stage_options options;
+    bounded_mpmc_queue<message> queue;
+    inlet<output> *downstream = nullptr;
+    std::atomic<unsigned> active_workers;
+
+    // in-order reassembly; next_seq - next_to_emit is the number of items
+    // accepted but not yet passed on, at most window()
+    std::mutex reorder_mtx;
+    std::condition_variable window_cond;
+    std::map<std::uint64_t, std::optional<output>> pending;
+    std::uint64_t next_seq = 0;
+    std::uint64_t next_to_emit = 0;
+
+    template <typename T> friend class ::pipeline::builder;
+
+    void emit(output value) {
+        if (downstream->offer(std::move(value))) {
+            emitted.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Emits under the lock, so results leave in order and a full
+    // downstream queue holds back every worker of this stage.
+    void complete(std::uint64_t seq, std::optional<output> value) {
+        std::lock_guard<std::mutex> lk(reorder_mtx);
+        pending.emplace(seq, std::move(value));
+        const std::uint64_t first = next_to_emit;
+        for (auto it = pending.begin();
+             it != pending.end() && it->first == next_to_emit;
+             it = pending.erase(it), ++next_to_emit) {
+            if (it->second) {
+                emit(std::move(*it->second));
+            }
+        }
+        if (next_to_emit != first) {
+            window_cond.notify_all();
+        }
+    }
+
+    // Every accepted item is queued, being handled or pending, so this
+    // doesn't hold back a stage whose items all take equally long.
+    std::uint64_t window() const {
+        return queue.capacity() + options.parallelism;
+    }
+
+    // Numbers the next item, once the window has room for it.
+    std::optional<std::uint64_t> take_seq() {
+        std::unique_lock<std::mutex> lk(reorder_mtx);
+        auto has_room = [this] { return next_seq - next_to_emit < window(); };
+        if (options.on_overflow == overflow::block) {
+            window_cond.wait(lk, has_room);
+        } else if (!has_room()) {
+            return std::nullopt;
+        }
+        return next_seq++;
+    }
+
+    void handle(std::uint64_t seq, In value) {
+        if constexpr (std::is_void_v<Out>) {
+            try {
+                fn(std::move(value));
+            } catch (...) {
+                failed.fetch_add(1, std::memory_order_relaxed);
+            }
+            processed.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            std::optional<output> result;
+            try {
+                if constexpr (filter_result<std::invoke_result_t<F &, In>>::
+                                  filters) {
+                    result = fn(std::move(value));
+                } else {
+                    result.emplace(fn(std::move(value)));
+                }
+            } catch (...) {
+                failed.fetch_add(1, std::memory_order_relaxed);
+            }
+            processed.fetch_add(1, std::memory_order_relaxed);
+            if (options.ordered) {
+                complete(seq, std::move(result));
+            } else if (result) {
+                emit(std::move(*result));
+            }
+        }
+    }
+
+    void worker_thread() {
+        message m;
+        while (true) {
+            queue.wait_and_pop(m);
+            if (!m.value) {
+                break;
+            }
+            handle(m.seq, std::move(*m.value));
+        }
+        if (active_workers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            mark_finished();
+            if constexpr (!std::is_void_v<Out>) {
+                downstream->end_of_stream();
+            }
+        }
+    }
+
+    void launch() override {
+        for (unsigned i = 0; i < options.parallelism; ++i) {
+            threads.emplace_back(&worker_stage::worker_thread, this);
+        }
+    }
+
+    std::size_t capacity() const override { return queue.capacity(); }
+    std::size_t queue_depth() const override { return queue.size(); }
+
+public:
+    worker_stage(std::string name_, F fn_, const stage_options &options_)
+        : stage_base(std::move(name_)), fn(std::move(fn_)),
+          options([&] {
+              stage_options res = options_;
+              res.parallelism = std::max(res.parallelism, 1u);
+              return res;
+          }()),
+          queue(options.capacity), active_workers(options.parallelism) {}
+
+    bool offer(In value) override {
+        const bool ordered = options.ordered && !std::is_void_v<Out>;
+        std::uint64_t seq = 0;
+        if (ordered) {
+            if (std::optional<std::uint64_t> next = take_seq()) {
+                seq = *next;
+            } else {
+                shed.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        message m{seq, std::move(value)};
+        if (options.on_overflow == overflow::block) {
+            queue.push(std::move(m));
+        } else if (!queue.try_push(std::move(m))) {
+            shed.fetch_add(1, std::memory_order_relaxed);
+            if constexpr (!std::is_void_v<Out>) {
+                if (ordered) {
+                    complete(seq, std::nullopt); // nothing to wait for
+                }
+            }
+            return false;
+        }
+        record_depth(queue.size());
+        return true;
+    }
+
+    // One marker per worker; they queue up behind the remaining items.
+    void end_of_stream() override {
+        for (unsigned i = 0; i < options.parallelism; ++i) {
+            queue.push(message{0, std::nullopt});
+        }
+    }
+};
+
+} // namespace detail
+
+class pipeline {
+private:
+    std::vector<std::unique_ptr<detail::stage_base>> stages;
+    bool started = false;
+
+    template <typename T> friend class builder;
+
+public:
+    pipeline() = default;
+    pipeline(pipeline &&) = default;
+    pipeline &operator=(pipeline &&) = default;
+
+    ~pipeline() { wait(); }
+
+    void start() {
+        if (!started) {
+            started = true;
+            for (auto &stage : stages) {
+                stage->start();
+            }
+        }
+    }
+
+    // Returns once the end of the stream has reached the sink.
+    void wait() {
+        for (auto &stage : stages) {
+            stage->join();
+        }
+    }
+
+    void run() {
+        start();
+        wait();
+    }
+
+    std::vector<stage_metrics> metrics() const {
+        std::vector<stage_metrics> res;
+        for (const auto &stage : stages) {
+            res.push_back(stage->metrics());
+        }
+        return res;
+    }
+};
+
+// Adds stages after one whose items are of type T.
+template <typename T> class builder {
+private:
+    pipeline pipe;
+    detail::inlet<T> **tail;
+
+    template <typename U> friend class builder;
+    template <typename Generator>
+    friend auto from(std::string name, Generator generate);
+
+    builder(pipeline pipe_, detail::inlet<T> **tail_)
+        : pipe(std::move(pipe_)), tail(tail_) {}
+
+    template <typename Generator>
+    static builder with_source(std::string name, Generator generate) {
+        auto stage = std::make_unique<detail::source_stage<T, Generator>>(
+            std::move(name), std::move(generate));
+        detail::inlet<T> **tail = &stage->downstream;
+        pipeline pipe;
+        pipe.stages.push_back(std::move(stage));
+        return builder(std::move(pipe), tail);
+    }
+
+public:
+    // `fn(T)` returns the item for the next stage, or std::optional of it.
+    template <typename F>
+    auto then(std::string name, F fn, stage_options options = {}) {
+        using result = std::invoke_result_t<F &, T>;
+        using U = typename detail::filter_result<result>::type;
+        auto stage = std::make_unique<detail::worker_stage<T, U, F>>(
+            std::move(name), std::move(fn), options);
+        *tail = stage.get();
+        detail::inlet<U> **next = &stage->downstream;
+        pipe.stages.push_back(std::move(stage));
+        return builder<U>(std::move(pipe), next);
+    }
+
+    // `fn(T)` consumes the items; returns the finished pipeline.
+    template <typename F>
+    pipeline sink(std::string name, F fn, stage_options options = {}) {
+        auto stage = std::make_unique<detail::worker_stage<T, void, F>>(
+            std::move(name), std::move(fn), options);
+        *tail = stage.get();
+        pipe.stages.push_back(std::move(stage));
+        return std::move(pipe);
+    }
+};
+
+// `generate()` returns std::optional<T>; std::nullopt ends the stream.
+template <typename Generator> auto from(std::string name, Generator generate) {
+    using T = typename std::invoke_result_t<Generator &>::value_type;
+    return builder<T>::with_source(std::move(name), std::move(generate));
+}
+
+} // namespace pipeline
+
+#endif // end of PIPELINE_HPP
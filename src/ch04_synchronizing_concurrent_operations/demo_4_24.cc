@@ -0,0 +1,151 @@
+// Listing 4.1 as a pipeline, and what bounded queues do for a slow consumer
+//
+// usage: demo_4_24 [items] [consumer work in microseconds]
+// First prepares and processes ten data_chunks like Listing 4.1, with four
+// processing threads whose results still come out in order and without a
+// `last` flag. Then a fast producer feeds a slow consumer: through an
+// unbounded threadsafe_queue (Listing 4.5) with a thread per role, and
+// through pipelines whose queue blocks or sheds when full. Queue depths are
+// sampled while they run.
+#include "demo_4_23.hpp"
+#include "listing_4_5.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using steady_clock = std::chrono::steady_clock;
+
+struct data_chunk {
+    int id;
+    int value;
+};
+
+void busy_work(std::chrono::microseconds duration) {
+    const auto until = steady_clock::now() + duration;
+    while (steady_clock::now() < until) {
+    }
+}
+
+void print_metrics(const std::vector<pipeline::stage_metrics> &metrics) {
+    std::cout << "  stage       processed   emitted      shed   depth    peak"
+                 "  capacity     items/s"
+              << std::endl;
+    for (const auto &m : metrics) {
+        std::cout << "  " << std::left << std::setw(10) << m.name << std::right
+                  << std::setw(11) << m.processed << std::setw(10)
+                  << m.emitted << std::setw(10) << m.shed << std::setw(8)
+                  << m.queue_depth << std::setw(8) << m.peak_queue_depth
+                  << std::setw(10) << m.capacity << std::setw(12)
+                  << std::fixed << std::setprecision(0) << m.items_per_second
+                  << std::endl;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const int items = argc > 1 ? std::atoi(argv[1]) : 200'000;
+    const std::chrono::microseconds work(argc > 2 ? std::atoi(argv[2]) : 5);
+
+    {
+        int next_id = 0;
+        std::mt19937 engine(42);
+        auto p =
+            pipeline::from("prepare",
+                           [&]() -> std::optional<data_chunk> {
+                               if (next_id == 10) {
+                                   return std::nullopt; // instead of `last`
+                               }
+                               std::this_thread::sleep_for(
+                                   std::chrono::milliseconds(engine() % 20));
+                               return data_chunk{next_id++, int(engine())};
+                           })
+                .then(
+                    "process",
+                    [](data_chunk data) {
+                        std::this_thread::sleep_for(
+                            std::chrono::milliseconds(data.value % 100 + 100));
+                        return data;
+                    },
+                    {4, 16, pipeline::overflow::block, true})
+                .sink("print", [](data_chunk data) {
+                    std::cout << "processed data_chunk " << data.id << ": "
+                              << data.value << std::endl;
+                });
+        p.run();
+        print_metrics(p.metrics());
+    }
+
+    std::cout << "\n" << items << " items, consumer busy for "
+              << work.count() << "us per item\n\nunbounded threadsafe_queue"
+              << std::endl;
+    {
+        threadsafe_queue<std::optional<int>> queue;
+        std::atomic<long> depth(0), peak(0);
+        auto t_start = steady_clock::now();
+        std::thread consumer([&] {
+            while (std::optional<int> item = queue.wait_and_pop_value()) {
+                --depth;
+                busy_work(work);
+            }
+        });
+        std::thread producer([&] {
+            for (int i = 0; i < items; ++i) {
+                peak = std::max(peak.load(), ++depth);
+                queue.push(i);
+            }
+            queue.push(std::nullopt);
+        });
+        producer.join();
+        consumer.join();
+        std::cout << "  peak depth " << peak << " ("
+                  << peak * sizeof(std::optional<int>) / 1024
+                  << " KiB of items alone), "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(
+                         steady_clock::now() - t_start)
+                         .count()
+                  << "ms" << std::endl;
+    }
+
+    for (pipeline::overflow policy :
+         {pipeline::overflow::block, pipeline::overflow::shed}) {
+        std::cout << "\npipeline, queue "
+                  << (policy == pipeline::overflow::block ? "blocks"
+                                                          : "sheds")
+                  << " when full" << std::endl;
+        int next = 0;
+        long long sum = 0;
+        auto p = pipeline::from("produce",
+                                [&]() -> std::optional<int> {
+                                    if (next == items) {
+                                        return std::nullopt;
+                                    }
+                                    return next++;
+                                })
+                     .sink(
+                         "consume",
+                         [&](int item) {
+                             busy_work(work);
+                             sum += item;
+                         },
+                         {1, 256, policy, false});
+        p.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        const pipeline::stage_metrics running = p.metrics().back();
+        std::cout << "  after 50ms: " << running.processed
+                  << " consumed, depth " << running.queue_depth << '/'
+                  << running.capacity << std::endl;
+        p.wait();
+        print_metrics(p.metrics());
+        if (policy == pipeline::overflow::block &&
+            sum != (long long)items * (items - 1) / 2) {
+            std::cerr << "wrong sum" << std::endl;
+            return 1;
+        }
+    }
+}
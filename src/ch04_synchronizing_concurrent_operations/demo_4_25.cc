@@ -0,0 +1,160 @@
+// The batch interface of threadsafe_queue (Listing 4.5)
+//
+// usage: demo_4_25 [producers] [items per producer]
+// Producers add their items with emplace() and push_range() in batches of
+// random size. One consumer takes single items with wait_and_pop_value() and
+// the others take batches of 8 to 32 with wait_and_pop_many(), giving up
+// after 5ms. Every consumer stops at a -1 sentinel; a consumer whose batch
+// holds more than one puts the others back. The main thread checks that
+// every item arrived exactly once and drains the queue with pop_many().
+//
+// Before that, a single item is pushed while one consumer waits for a
+// batch of four and another waits for any item: the second one has to get
+// it right away, not after the first one's timeout.
+#include "listing_4_5.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+using steady_clock = std::chrono::steady_clock;
+
+struct consumer_stats {
+    long items = 0;
+    long batches = 0;
+    long full_batches = 0; // at least min_count elements
+};
+
+bool single_waiter_is_not_starved() {
+    threadsafe_queue<int> queue;
+    std::atomic<long long> waited_ms(-1);
+    std::thread batch_consumer([&] {
+        std::vector<int> out;
+        queue.wait_and_pop_many(std::back_inserter(out), 4, 4,
+                                std::chrono::seconds(2));
+    });
+    std::thread single_consumer([&] {
+        const auto t_start = steady_clock::now();
+        queue.wait_and_pop_value();
+        waited_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        steady_clock::now() - t_start)
+                        .count();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    queue.push(1);
+    batch_consumer.join();
+    if (waited_ms < 0) {
+        queue.push(2); // still asleep after the batch wait timed out
+    }
+    single_consumer.join();
+    std::cout << "single consumer got the item after " << waited_ms
+              << "ms (pushed after 100ms)" << std::endl;
+    return waited_ms < 1000;
+}
+
+int main(int argc, char *argv[]) {
+    const int producers = argc > 1 ? std::atoi(argv[1]) : 4;
+    const int items = argc > 2 ? std::atoi(argv[2]) : 200'000;
+    const int consumers = 4;
+    const std::size_t min_count = 8, max_count = 32;
+
+    bool ok = single_waiter_is_not_starved();
+
+    threadsafe_queue<int> queue;
+    std::unique_ptr<std::atomic<int>[]> seen(
+        new std::atomic<int>[long(producers) * items]());
+    std::vector<consumer_stats> stats(consumers);
+    std::vector<std::thread> threads;
+    auto t_start = steady_clock::now();
+
+    for (int c = 0; c < consumers; ++c) {
+        threads.emplace_back([&, c] {
+            consumer_stats &mine = stats[c];
+            std::vector<int> batch;
+            for (bool stop = false; !stop;) {
+                batch.clear();
+                if (c == 0) {
+                    batch.push_back(queue.wait_and_pop_value());
+                } else {
+                    const std::size_t count = queue.wait_and_pop_many(
+                        std::back_inserter(batch), min_count, max_count,
+                        std::chrono::milliseconds(5));
+                    mine.full_batches += count >= min_count;
+                }
+                ++mine.batches;
+                long sentinels = 0;
+                for (int item : batch) {
+                    if (item < 0) {
+                        ++sentinels;
+                    } else {
+                        seen[item].fetch_add(1, std::memory_order_relaxed);
+                        ++mine.items;
+                    }
+                }
+                if (sentinels > 0) {
+                    // one is ours, the rest belong to the other consumers
+                    const std::vector<int> others(sentinels - 1, -1);
+                    queue.push_range(others.begin(), others.end());
+                    stop = true;
+                }
+            }
+        });
+    }
+    std::vector<std::thread> producer_threads;
+    for (int p = 0; p < producers; ++p) {
+        producer_threads.emplace_back([&, p] {
+            std::minstd_rand engine(p + 1);
+            std::vector<int> batch;
+            for (int i = 0; i < items;) {
+                const int n = std::min<int>(items - i, engine() % 16);
+                if (n <= 1) {
+                    queue.emplace(p * items + i++);
+                    continue;
+                }
+                batch.clear();
+                for (int j = 0; j < n; ++j) {
+                    batch.push_back(p * items + i++);
+                }
+                queue.push_range(batch.begin(), batch.end());
+            }
+        });
+    }
+    for (auto &thread : producer_threads) {
+        thread.join();
+    }
+    for (int c = 0; c < consumers; ++c) {
+        queue.push(-1);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        steady_clock::now() - t_start)
+                        .count();
+
+    std::vector<int> left;
+    queue.pop_many(std::back_inserter(left), max_count);
+    for (long i = 0; i < long(producers) * items; ++i) {
+        ok = ok && seen[i].load() == 1;
+    }
+    ok = ok && left.empty() && queue.empty();
+
+    std::cout << producers << " producers x " << items << " items in " << ms
+              << "ms\nconsumer\titems\tcalls\tbatches of >= " << min_count
+              << std::endl;
+    for (int c = 0; c < consumers; ++c) {
+        std::cout << (c == 0 ? "single" : "batch") << '\t' << '\t'
+                  << stats[c].items << '\t' << stats[c].batches << '\t'
+                  << (c == 0 ? 0 : stats[c].full_batches) << std::endl;
+    }
+    if (!ok) {
+        std::cerr << "items lost, duplicated or left over" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,36 @@
+// Listing 4.13's parallel_quicksort, for the demos that compare against it
+//
+// Every partition starts a std::async with the default launch policy, so a
+// list of n elements asks for up to n threads; on sorted input the recursion
+// is n levels deep as well. The demos only run it on inputs small enough
+// for that.
+#ifndef ASYNC_QUICKSORT_HPP
+#define ASYNC_QUICKSORT_HPP
+
+#include <algorithm>
+#include <future>
+#include <list>
+#include <utility>
+
+// the same as Listing 4.13
+template <typename T>
+std::list<T> async_quicksort(std::list<T> input) {
+    if (input.empty()) {
+        return input;
+    }
+    std::list<T> result;
+    result.splice(result.begin(), input, input.begin());
+    const T &pivot = *result.begin();
+    auto divide_point = std::partition(input.begin(), input.end(),
+                                       [&](const T &t) { return t < pivot; });
+    std::list<T> lower_part;
+    lower_part.splice(lower_part.end(), input, input.begin(), divide_point);
+    std::future<std::list<T>> new_lower(
+        std::async(&async_quicksort<T>, std::move(lower_part)));
+    auto new_higher(async_quicksort(std::move(input)));
+    result.splice(result.end(), new_higher);
+    result.splice(result.begin(), new_lower.get());
+    return result;
+}
+
+#endif // end of ASYNC_QUICKSORT_HPP
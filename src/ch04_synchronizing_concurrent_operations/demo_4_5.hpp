@@ -0,0 +1,280 @@
+// A work-stealing thread pool
+//
+// Every worker owns a deque of tasks: it pushes and pops its own work at the
+// front (LIFO, cache friendly) and, when it runs dry, steals from the back of
+// a randomly chosen victim. Tasks submitted from outside the pool go through
+// a shared FIFO queue. A thread that waits on a future returned by `submit()`
+// should call `wait()`, which keeps running pending tasks until the future is
+// ready instead of blocking. Every task it runs that way may wait and help in
+// turn, one stack frame deeper, so past max_help_depth nested waits a thread
+// only runs tasks from its own queue, which it pushed itself.
+#ifndef WORK_STEALING_THREAD_POOL_HPP
+#define WORK_STEALING_THREAD_POOL_HPP
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A move-only type-erased callable; `std::function` requires copyable targets,
+// which rules out `std::packaged_task`.
+class function_wrapper {
+private:
+    struct impl_base {
+        virtual void call() = 0;
+        virtual ~impl_base() {}
+    };
+
+    template <typename F> struct impl_type : impl_base {
+        F f;
+        impl_type(F &&f_) : f(std::move(f_)) {}
+        void call() override { f(); }
+    };
+
+    std::unique_ptr<impl_base> impl;
+
+public:
+    function_wrapper() = default;
+
+    template <typename F>
+    function_wrapper(F &&f)
+        : impl(new impl_type<std::decay_t<F>>(std::forward<F>(f))) {}
+
+    function_wrapper(function_wrapper &&other) = default;
+    function_wrapper &operator=(function_wrapper &&other) = default;
+    function_wrapper(const function_wrapper &) = delete;
+    function_wrapper &operator=(const function_wrapper &) = delete;
+
+    void operator()() { impl->call(); }
+};
+
+class work_stealing_queue {
+private:
+    std::deque<function_wrapper> the_queue;
+    mutable std::mutex mtx;
+
+public:
+    work_stealing_queue() {}
+
+    work_stealing_queue(const work_stealing_queue &) = delete;
+    work_stealing_queue &operator=(const work_stealing_queue &) = delete;
+
+    void push(function_wrapper data) {
+        std::lock_guard<std::mutex> lk(mtx);
+        the_queue.push_front(std::move(data));
+    }
+
+    bool try_pop(function_wrapper &res) {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (the_queue.empty()) {
+            return false;
+        }
+        res = std::move(the_queue.front());
+        the_queue.pop_front();
+        return true;
+    }
+
+    bool try_steal(function_wrapper &res) {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (the_queue.empty()) {
+            return false;
+        }
+        res = std::move(the_queue.back());
+        the_queue.pop_back();
+        return true;
+    }
+
+    bool empty() const {
+        std::lock_guard<std::mutex> lk(mtx);
+        return the_queue.empty();
+    }
+};
+
+class thread_pool {
+private:
+    std::atomic_bool done;
+    // tasks queued but not yet picked up, used to park idle workers
+    std::atomic<long> pending_tasks;
+    std::atomic<unsigned> idle_workers;
+    std::mutex idle_mtx;
+    std::condition_variable idle_cond;
+    work_stealing_queue pool_work_queue;
+    std::vector<std::unique_ptr<work_stealing_queue>> queues;
+    std::vector<std::thread> threads;
+
+    inline static thread_local const thread_pool *owner = nullptr;
+    inline static thread_local work_stealing_queue *local_work_queue = nullptr;
+    inline static thread_local unsigned my_index = 0;
+    // how many wait() calls on this thread are running a task
+    inline static thread_local unsigned help_depth = 0;
+
+    void worker_thread(unsigned index) {
+        owner = this;
+        my_index = index;
+        local_work_queue = queues[index].get();
+        while (!done) {
+            if (!try_run_pending_task()) {
+                wait_for_work();
+            }
+        }
+    }
+
+    void wait_for_work() {
+        std::unique_lock<std::mutex> lk(idle_mtx);
+        ++idle_workers;
+        idle_cond.wait(lk, [this] { return done || pending_tasks > 0; });
+        --idle_workers;
+    }
+
+    void notify_new_work() {
+        ++pending_tasks;
+        if (idle_workers != 0) {
+            { std::lock_guard<std::mutex> lk(idle_mtx); }
+            idle_cond.notify_one();
+        }
+    }
+
+    bool is_own_worker() const { return owner == this; }
+
+    bool pop_task_from_local_queue(function_wrapper &task) {
+        return is_own_worker() && local_work_queue->try_pop(task);
+    }
+
+    bool pop_task_from_pool_queue(function_wrapper &task) {
+        return pool_work_queue.try_steal(task);
+    }
+
+    bool pop_task_from_other_thread_queue(function_wrapper &task) {
+        thread_local std::minstd_rand engine(static_cast<unsigned>(
+            std::hash<std::thread::id>()(std::this_thread::get_id())));
+        const unsigned count = static_cast<unsigned>(queues.size());
+        const unsigned start =
+            std::uniform_int_distribution<unsigned>(0, count - 1)(engine);
+        for (unsigned i = 0; i < count; ++i) {
+            const unsigned victim = (start + i) % count;
+            if (is_own_worker() && victim == my_index) {
+                continue;
+            }
+            if (queues[victim]->try_steal(task)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool try_run_pending_task() {
+        function_wrapper task;
+        if (pop_task_from_local_queue(task) ||
+            pop_task_from_pool_queue(task) ||
+            pop_task_from_other_thread_queue(task)) {
+            --pending_tasks;
+            task();
+            return true;
+        }
+        return false;
+    }
+
+    void push_task(function_wrapper task) {
+        if (is_own_worker()) {
+            local_work_queue->push(std::move(task));
+        } else {
+            pool_work_queue.push(std::move(task));
+        }
+        notify_new_work();
+    }
+
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> lk(idle_mtx);
+            done = true;
+        }
+        idle_cond.notify_all();
+        for (auto &thread : threads) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+    }
+
+public:
+    explicit thread_pool(
+        unsigned thread_count = std::thread::hardware_concurrency())
+        : done(false), pending_tasks(0), idle_workers(0) {
+        thread_count = std::max(thread_count, 1u);
+        try {
+            for (unsigned i = 0; i < thread_count; ++i) {
+                queues.push_back(std::make_unique<work_stealing_queue>());
+            }
+            for (unsigned i = 0; i < thread_count; ++i) {
+                threads.push_back(
+                    std::thread(&thread_pool::worker_thread, this, i));
+            }
+        } catch (...) {
+            shutdown();
+            throw;
+        }
+    }
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    ~thread_pool() { shutdown(); }
+
+    unsigned size() const { return static_cast<unsigned>(queues.size()); }
+
+    template <typename FunctionType>
+    std::future<std::invoke_result_t<FunctionType>> submit(FunctionType f) {
+        using result_type = std::invoke_result_t<FunctionType>;
+        std::packaged_task<result_type()> task(std::move(f));
+        std::future<result_type> res(task.get_future());
+        push_task(std::move(task));
+        return res;
+    }
+
+    // Queues `f` without a future, for callers that report completion some
+    // other way, such as the continuations of demo_4_17.hpp.
+    template <typename FunctionType> void post(FunctionType f) {
+        push_task(std::move(f));
+    }
+
+    void run_pending_task() {
+        if (!try_run_pending_task()) {
+            std::this_thread::yield();
+        }
+    }
+
+    static constexpr unsigned max_help_depth = 8;
+
+    // Helps out with pending work until `f` is ready, so a worker waiting on
+    // one of its children never sits idle.
+    template <typename ResultType> void wait(const std::future<ResultType> &f) {
+        while (f.wait_for(std::chrono::seconds(0)) !=
+               std::future_status::ready) {
+            function_wrapper task;
+            if (pop_task_from_local_queue(task) ||
+                (help_depth < max_help_depth &&
+                 (pop_task_from_pool_queue(task) ||
+                  pop_task_from_other_thread_queue(task)))) {
+                --pending_tasks;
+                ++help_depth;
+                struct leave {
+                    ~leave() { --help_depth; }
+                } guard;
+                task();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+};
+
+#endif // end of WORK_STEALING_THREAD_POOL_HPP
@@ -0,0 +1,143 @@
+// Parallel Quicksort on a work-stealing thread pool vs. std::async
+//
+// usage: demo_4_6 [number of elements]
+// For every core count 1, 2, 4 ... N the process is pinned to that many CPUs
+// and both versions sort the same random list. std::async starts a thread
+// per element, so it only runs up to max_async_elements.
+#include "demo_4_5.hpp"
+#include "demo_4_26.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <list>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+using steady_clock = std::chrono::steady_clock;
+
+// Past this many threads std::async fails to start one, and libstdc++'s
+// fallback to a deferred call runs it on an already moved-from partition.
+constexpr long max_async_elements = 200'000;
+
+// Below this length a partition is sorted by the task that owns it.
+constexpr std::size_t sequential_cutoff = 1 << 10;
+
+template <typename T> struct sorter {
+    thread_pool &pool;
+
+    explicit sorter(thread_pool &pool_) : pool(pool_) {}
+
+    std::list<T> do_sort(std::list<T> &chunk_data) {
+        std::list<T> result;
+        if (chunk_data.size() <= sequential_cutoff) {
+            result.splice(result.begin(), chunk_data);
+            result.sort();
+            return result;
+        }
+        result.splice(result.begin(), chunk_data, chunk_data.begin());
+        const T &pivot = *result.begin();
+        auto divide_point =
+            std::partition(chunk_data.begin(), chunk_data.end(),
+                           [&](const T &t) { return t < pivot; });
+        std::list<T> new_lower_chunk;
+        new_lower_chunk.splice(new_lower_chunk.end(), chunk_data,
+                               chunk_data.begin(), divide_point);
+        std::future<std::list<T>> new_lower = pool.submit(
+            [this, chunk = std::move(new_lower_chunk)]() mutable {
+                return do_sort(chunk);
+            });
+        std::list<T> new_higher(do_sort(chunk_data));
+        result.splice(result.end(), new_higher);
+        pool.wait(new_lower); // runs other tasks instead of blocking
+        result.splice(result.begin(), new_lower.get());
+        return result;
+    }
+};
+
+template <typename T>
+std::list<T> pool_quicksort(thread_pool &pool, std::list<T> input) {
+    if (input.empty()) {
+        return input;
+    }
+    sorter<T> s(pool);
+    return s.do_sort(input);
+}
+
+// Restricts the calling thread, and every thread it creates afterwards, to
+// the first `cores` CPUs.
+bool pin_to_cores(unsigned cores) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned i = 0; i < cores; ++i) {
+        CPU_SET(i, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cores;
+    return false;
+#endif
+}
+
+template <typename F> long long time_ms(F f) {
+    auto t_start = steady_clock::now();
+    f();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               steady_clock::now() - t_start)
+        .count();
+}
+
+int main(int argc, char *argv[]) {
+    const long n = argc > 1 ? std::atol(argv[1]) : 100'000;
+    const unsigned hardware_threads =
+        std::max(std::thread::hardware_concurrency(), 1u);
+
+    std::mt19937 engine(42);
+    std::uniform_int_distribution<int> dist;
+    std::list<int> input;
+    for (long i = 0; i < n; ++i) {
+        input.push_back(dist(engine));
+    }
+    std::list<int> expected(input);
+    expected.sort();
+
+    std::cout << "sorting " << n << " elements\n"
+              << "cores\tstd::async(ms)\tthread_pool(ms)" << std::endl;
+    for (unsigned cores = 1;; cores = std::min(cores * 2, hardware_threads)) {
+        if (!pin_to_cores(cores)) {
+            std::cout << "(could not set CPU affinity)" << std::endl;
+        }
+        const bool with_async = n <= max_async_elements;
+        std::list<int> async_result(with_async ? std::list<int>() : expected),
+            pool_result;
+        long long async_ms = time_ms([&] {
+            if (with_async) {
+                async_result = async_quicksort(input);
+            }
+        });
+        long long pool_ms = time_ms([&] {
+            thread_pool pool(cores);
+            pool_result = pool_quicksort(pool, input);
+        });
+        if (async_result != expected || pool_result != expected) {
+            std::cerr << "wrong result with " << cores << " cores"
+                      << std::endl;
+            return 1;
+        }
+        std::cout << cores << '\t'
+                  << (with_async ? std::to_string(async_ms) : "-") << '\t'
+                  << pool_ms << std::endl;
+        if (cores == hardware_threads) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,272 @@
+// A lock-free bounded MPMC queue with the interface of threadsafe_queue
+//
+// The queue is a power-of-two ring of cells, each carrying a sequence number
+// (Dmitry Vyukov's bounded MPMC queue). A producer claims position `pos` with
+// a CAS on `enqueue_pos` once the cell's sequence equals `pos`, writes the
+// value and publishes it by setting the sequence to `pos + 1`. A consumer
+// claims the cell when its sequence is `pos + 1` and hands it back to the
+// producers of the next lap by setting it to `pos + capacity`.
+//
+// `try_push`/`try_pop` never block. `push` blocks only while the queue is
+// full and `wait_and_pop` only while it is empty; how they wait is decided by
+// the `WaitStrategy` parameter.
+#ifndef BOUNDED_MPMC_QUEUE_HPP
+#define BOUNDED_MPMC_QUEUE_HPP
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// A wait strategy is used as: `key = prepare_wait()`, re-check the queue,
+// then `wait(key)`, or `cancel_wait()` if the re-check succeeded; the other
+// side calls `notify_one()` after every change, which can only help a single
+// waiter. `wait` may return spuriously, the caller always re-checks.
+
+// Busy-waits; lowest latency, burns a core per waiter.
+struct spin_wait {
+    std::uint32_t prepare_wait() { return 0; }
+
+    void cancel_wait() {}
+
+    void wait(std::uint32_t) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    void notify_one() {}
+};
+
+// Gives up the time slice between checks.
+struct yield_wait {
+    std::uint32_t prepare_wait() { return 0; }
+
+    void cancel_wait() {}
+
+    void wait(std::uint32_t) { std::this_thread::yield(); }
+
+    void notify_one() {}
+};
+
+#ifdef __linux__
+// Sleeps in the kernel on a futex. A waiter registers in `sleepers` before
+// its re-check; the notifying side, after its change, reads `sleepers` and
+// leaves the shared `epoch` alone unless somebody may be asleep. Either the
+// re-check sees the change or the notifier sees the waiter: both sides are
+// ordered by a sequentially consistent fence.
+class futex_wait {
+private:
+    std::atomic<std::uint32_t> epoch;
+    std::atomic<std::uint32_t> sleepers;
+
+    static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t),
+                  "futex word must be a plain 32-bit integer");
+
+public:
+    futex_wait() : epoch(0), sleepers(0) {}
+
+    std::uint32_t prepare_wait() {
+        sleepers.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return epoch.load(std::memory_order_relaxed);
+    }
+
+    void cancel_wait() { sleepers.fetch_sub(1, std::memory_order_relaxed); }
+
+    void wait(std::uint32_t key) {
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&epoch),
+                FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // A waiter that is registered but not asleep yet sees the new epoch and
+    // doesn't go to sleep.
+    void notify_one() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        epoch.fetch_add(1, std::memory_order_relaxed);
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&epoch),
+                FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+};
+
+using default_wait_strategy = futex_wait;
+#else
+using default_wait_strategy = yield_wait;
+#endif
+
+template <typename T, typename WaitStrategy = default_wait_strategy>
+class bounded_mpmc_queue {
+private:
+    static constexpr std::size_t cache_line_size = 64;
+
+    struct cell {
+        std::atomic<std::size_t> sequence;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T *value() { return std::launder(reinterpret_cast<T *>(storage)); }
+    };
+
+    const std::size_t mask;
+    const std::unique_ptr<cell[]> buffer;
+    alignas(cache_line_size) std::atomic<std::size_t> enqueue_pos;
+    alignas(cache_line_size) std::atomic<std::size_t> dequeue_pos;
+    alignas(cache_line_size) WaitStrategy not_empty;
+    alignas(cache_line_size) WaitStrategy not_full;
+
+    static std::size_t round_up_to_power_of_two(std::size_t n) {
+        std::size_t res = 2;
+        while (res < n) {
+            res <<= 1;
+        }
+        return res;
+    }
+
+    // a throwing move would leave a hole in the ring for good
+    static_assert(std::is_nothrow_move_constructible<T>::value,
+                  "T must be nothrow move constructible");
+
+    bool do_try_push(T &&new_value) {
+        std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        cell *c;
+        for (;;) {
+            c = &buffer[pos & mask];
+            const std::size_t seq = c->sequence.load(std::memory_order_acquire);
+            const std::intptr_t diff =
+                static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        ::new (static_cast<void *>(c->storage)) T(std::move(new_value));
+        c->sequence.store(pos + 1, std::memory_order_release);
+        not_empty.notify_one();
+        return true;
+    }
+
+public:
+    explicit bounded_mpmc_queue(std::size_t capacity = 1024)
+        : mask(round_up_to_power_of_two(capacity) - 1),
+          buffer(new cell[mask + 1]), enqueue_pos(0), dequeue_pos(0) {
+        for (std::size_t i = 0; i <= mask; ++i) {
+            buffer[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bounded_mpmc_queue(const bounded_mpmc_queue &) = delete;
+    bounded_mpmc_queue &operator=(const bounded_mpmc_queue &) = delete;
+
+    ~bounded_mpmc_queue() {
+        T value;
+        while (try_pop(value)) {
+        }
+    }
+
+    std::size_t capacity() const { return mask + 1; }
+
+    bool try_push(const T &new_value) {
+        T copy(new_value);
+        return do_try_push(std::move(copy));
+    }
+
+    bool try_push(T &&new_value) { return do_try_push(std::move(new_value)); }
+
+    void push(T new_value) {
+        while (!try_push(std::move(new_value))) {
+            const std::uint32_t key = not_full.prepare_wait();
+            if (try_push(std::move(new_value))) {
+                not_full.cancel_wait();
+                return;
+            }
+            not_full.wait(key);
+        }
+    }
+
+    bool try_pop(T &value) {
+        std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        cell *c;
+        for (;;) {
+            c = &buffer[pos & mask];
+            const std::size_t seq = c->sequence.load(std::memory_order_acquire);
+            const std::intptr_t diff = static_cast<std::intptr_t>(seq) -
+                                       static_cast<std::intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; // empty
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(*c->value());
+        c->value()->~T();
+        c->sequence.store(pos + mask + 1, std::memory_order_release);
+        not_full.notify_one();
+        return true;
+    }
+
+    std::shared_ptr<T> try_pop() {
+        T value;
+        if (!try_pop(value)) {
+            return std::shared_ptr<T>();
+        }
+        return std::make_shared<T>(std::move(value));
+    }
+
+    void wait_and_pop(T &value) {
+        while (!try_pop(value)) {
+            const std::uint32_t key = not_empty.prepare_wait();
+            if (try_pop(value)) {
+                not_empty.cancel_wait();
+                return;
+            }
+            not_empty.wait(key);
+        }
+    }
+
+    std::shared_ptr<T> wait_and_pop() {
+        T value;
+        wait_and_pop(value);
+        return std::make_shared<T>(std::move(value));
+    }
+
+    // Only a snapshot, like empty(). A producer claims a position only after
+    // the consumer one lap behind has claimed its own, so with enqueue_pos
+    // read first the difference stays within the capacity. Cells count from
+    // the moment they are claimed, while the value is still being written.
+    std::size_t size() const {
+        const std::size_t pushed = enqueue_pos.load(std::memory_order_relaxed);
+        const std::size_t popped = dequeue_pos.load(std::memory_order_relaxed);
+        return pushed > popped ? pushed - popped : 0;
+    }
+
+    // only a snapshot: other threads may change it right after the call
+    bool empty() const {
+        const std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        return buffer[pos & mask].sequence.load(std::memory_order_acquire) !=
+               pos + 1;
+    }
+};
+
+#endif // end of BOUNDED_MPMC_QUEUE_HPP
@@ -0,0 +1,64 @@
+// threadsafe_queue vs. bounded_mpmc_queue under many producers and consumers
+//
+// usage: demo_4_8 [threads per side] [items per producer]
+#include "listing_4_5.hpp"
+#include "demo_4_7.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using steady_clock = std::chrono::steady_clock;
+
+template <typename Queue>
+void run(const std::string &name, Queue &queue, int threads, long items) {
+    std::atomic<long long> total(0);
+    std::vector<std::thread> workers;
+    auto t_start = steady_clock::now();
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back([&] {
+            for (long j = 1; j <= items; ++j) {
+                queue.push(j);
+            }
+        });
+        workers.emplace_back([&] {
+            long long sum = 0;
+            long value;
+            for (long j = 0; j < items; ++j) {
+                queue.wait_and_pop(value);
+                sum += value;
+            }
+            total += sum;
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    auto elapse = std::chrono::duration_cast<std::chrono::milliseconds>(
+        steady_clock::now() - t_start);
+    const long long expected =
+        static_cast<long long>(threads) * items * (items + 1) / 2;
+    std::cout << name << ": " << elapse.count() << "ms"
+              << (total == expected ? "" : " (WRONG SUM)") << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    const int threads = argc > 1 ? std::atoi(argv[1]) : 8;
+    const long items = argc > 2 ? std::atol(argv[2]) : 100'000;
+    std::cout << threads << " producers, " << threads << " consumers, "
+              << items << " items each" << std::endl;
+
+    threadsafe_queue<long> locked;
+    run("threadsafe_queue          ", locked, threads, items);
+#ifdef __linux__
+    bounded_mpmc_queue<long, futex_wait> futex_queue;
+    run("bounded_mpmc_queue (futex)", futex_queue, threads, items);
+#endif
+    bounded_mpmc_queue<long, yield_wait> yield_queue;
+    run("bounded_mpmc_queue (yield)", yield_queue, threads, items);
+    bounded_mpmc_queue<long, spin_wait> spin_queue;
+    run("bounded_mpmc_queue (spin) ", spin_queue, threads, items);
+}
@@ -0,0 +1,141 @@
+// A thread-safe queue with fine-grained locking and waiting
+//
+// Unlike threadsafe_queue (Listing 4.5), which guards a std::queue with one
+// mutex, this queue is a singly-linked list with separate mutexes for the
+// head and the tail. A dummy node always sits at the tail, so `push` only
+// touches the tail and `pop` only touches the head, and producers and
+// consumers don't block each other unless the queue is empty.
+#ifndef FINE_GRAINED_QUEUE_HPP
+#define FINE_GRAINED_QUEUE_HPP
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+template <typename T> class fine_grained_queue {
+private:
+    struct node {
+        std::shared_ptr<T> data;
+        std::unique_ptr<node> next;
+    };
+
+    mutable std::mutex head_mutex;
+    std::unique_ptr<node> head;
+    mutable std::mutex tail_mutex;
+    node *tail;
+    std::condition_variable data_cond;
+    // consumers inside wait_for_data(); push() only notifies if there are any
+    std::atomic<unsigned> waiting{0};
+
+    node *get_tail() const {
+        std::lock_guard<std::mutex> tail_lock(tail_mutex);
+        return tail;
+    }
+
+    std::unique_ptr<node> pop_head() {
+        std::unique_ptr<node> old_head = std::move(head);
+        head = std::move(old_head->next);
+        return old_head;
+    }
+
+    std::unique_lock<std::mutex> wait_for_data() {
+        std::unique_lock<std::mutex> head_lock(head_mutex);
+        if (head.get() == get_tail()) {
+            waiting.fetch_add(1, std::memory_order_seq_cst);
+            data_cond.wait(head_lock,
+                           [&] { return head.get() != get_tail(); });
+            waiting.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return head_lock;
+    }
+
+    std::unique_ptr<node> wait_pop_head() {
+        std::unique_lock<std::mutex> head_lock(wait_for_data());
+        return pop_head();
+    }
+
+    std::unique_ptr<node> wait_pop_head(T &value) {
+        std::unique_lock<std::mutex> head_lock(wait_for_data());
+        value = std::move(*head->data);
+        return pop_head();
+    }
+
+    std::unique_ptr<node> try_pop_head() {
+        std::lock_guard<std::mutex> head_lock(head_mutex);
+        if (head.get() == get_tail()) {
+            return std::unique_ptr<node>();
+        }
+        return pop_head();
+    }
+
+    std::unique_ptr<node> try_pop_head(T &value) {
+        std::lock_guard<std::mutex> head_lock(head_mutex);
+        if (head.get() == get_tail()) {
+            return std::unique_ptr<node>();
+        }
+        value = std::move(*head->data);
+        return pop_head();
+    }
+
+public:
+    fine_grained_queue() : head(new node), tail(head.get()) {}
+
+    fine_grained_queue(const fine_grained_queue &other) = delete;
+    fine_grained_queue &operator=(const fine_grained_queue &other) = delete;
+
+    ~fine_grained_queue() {
+        // unlink iteratively, the recursive destruction of a long chain of
+        // unique_ptrs could overflow the stack
+        while (head) {
+            head = std::move(head->next);
+        }
+    }
+
+    void push(T new_value) {
+        std::shared_ptr<T> new_data(std::make_shared<T>(std::move(new_value)));
+        std::unique_ptr<node> p(new node);
+        {
+            std::lock_guard<std::mutex> tail_lock(tail_mutex);
+            tail->data = new_data;
+            node *const new_tail = p.get();
+            tail->next = std::move(p);
+            tail = new_tail;
+        }
+        // A consumer counts itself in `waiting` before it re-checks the tail
+        // under tail_mutex, so either it sees the new node or we see it here.
+        // Passing through head_mutex makes sure it is then either before its
+        // re-check or already waiting, so the notification can't fall in
+        // between. Without waiters, producers never touch head_mutex.
+        if (waiting.load(std::memory_order_seq_cst) != 0) {
+            { std::lock_guard<std::mutex> head_lock(head_mutex); }
+            data_cond.notify_one();
+        }
+    }
+
+    std::shared_ptr<T> wait_and_pop() {
+        const std::unique_ptr<node> old_head = wait_pop_head();
+        return old_head->data;
+    }
+
+    void wait_and_pop(T &value) {
+        const std::unique_ptr<node> old_head = wait_pop_head(value);
+    }
+
+    std::shared_ptr<T> try_pop() {
+        std::unique_ptr<node> old_head = try_pop_head();
+        return old_head ? old_head->data : std::shared_ptr<T>();
+    }
+
+    bool try_pop(T &value) {
+        const std::unique_ptr<node> old_head = try_pop_head(value);
+        return old_head != nullptr;
+    }
+
+    bool empty() const {
+        std::lock_guard<std::mutex> head_lock(head_mutex);
+        return head.get() == get_tail();
+    }
+};
+
+#endif // end of FINE_GRAINED_QUEUE_HPP
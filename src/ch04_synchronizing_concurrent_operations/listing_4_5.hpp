@@ -2,70 +2,259 @@
 // variables
 #ifndef THREADSAFE_QUEUE_HPP
 #define THREADSAFE_QUEUE_HPP
+#include <algorithm>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <iterator>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <queue>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// `Allocator` is used by the underlying std::deque; see recycling_allocator
+// (../ch03_sharing_data_between_threads/demo_3_7.hpp) for one that avoids
+// heap allocations in steady state.
+// `Mutex` can be any lockable, e.g. profiled_mutex
+// (../ch03_sharing_data_between_threads/demo_3_14.hpp); anything but
+// std::mutex waits on a std::condition_variable_any.
+template <typename T, typename Allocator = std::allocator<T>,
+          typename Mutex = std::mutex>
+class threadsafe_queue {
+public:
+    // A consumer that waits without blocking a thread, such as a suspended
+    // coroutine (coro::async_queue in demo_4_19.hpp). A push hands it the
+    // element directly and then, without the lock, calls ready().
+    class async_waiter {
+    public:
+        std::optional<T> value;
+
+        virtual void ready() = 0;
+
+    protected:
+        ~async_waiter() = default;
+    };
 
-template <typename T> class threadsafe_queue {
 private:
-    std::queue<T> data_queue;
-    std::condition_variable data_cond;
-    mutable std::mutex mtx;
+    std::queue<T, std::deque<T, Allocator>> data_queue;
+    std::conditional_t<std::is_same<Mutex, std::mutex>::value,
+                       std::condition_variable, std::condition_variable_any>
+        data_cond;
+    mutable Mutex mtx;
+    // consumers blocked in a wait, and how many of them want more than one
+    // element
+    std::size_t waiters = 0;
+    std::size_t batch_waiters = 0;
+    // served before the blocked ones, in FIFO order
+    std::deque<async_waiter *> async_waiters;
+
+    async_waiter *take_async_waiter() {
+        if (async_waiters.empty()) {
+            return nullptr;
+        }
+        async_waiter *w = async_waiters.front();
+        async_waiters.pop_front();
+        return w;
+    }
+
+    // Called with `mtx` held once `count` elements were added. A waiter for
+    // several elements may take a notify_one() it can't use yet while
+    // another waiter could, so as long as one waits everybody is woken.
+    void notify_added(std::size_t count) {
+        if (batch_waiters != 0) {
+            data_cond.notify_all();
+            return;
+        }
+        for (std::size_t i = 0, n = std::min(count, waiters); i < n; ++i) {
+            data_cond.notify_one();
+        }
+    }
+
+    template <typename Lock> void wait_for_data(Lock &lk) {
+        ++waiters;
+        data_cond.wait(lk, [this] { return !data_queue.empty(); });
+        --waiters;
+    }
+
+    template <typename OutputIt>
+    std::size_t pop_many_locked(OutputIt &out, std::size_t max_count) {
+        std::size_t count = 0;
+        for (; count < max_count && !data_queue.empty(); ++count) {
+            *out = std::move(data_queue.front());
+            ++out;
+            data_queue.pop();
+        }
+        return count;
+    }
 
 public:
     threadsafe_queue() {}
 
     threadsafe_queue(const threadsafe_queue &other) {
-        std::lock_guard<std::mutex> lk(other.mtx);
+        std::lock_guard<Mutex> lk(other.mtx);
         data_queue = other.data_queue;
     }
 
     threadsafe_queue &operator=(const threadsafe_queue &rhs) = delete;
 
     void push(T new_value) {
-        std::lock_guard<std::mutex> lk(mtx);
-        data_queue.push(new_value);
-        data_cond.notify_one();
+        async_waiter *w;
+        {
+            std::lock_guard<Mutex> lk(mtx);
+            w = take_async_waiter();
+            if (!w) {
+                data_queue.push(std::move(new_value));
+                notify_added(1);
+                return;
+            }
+            w->value.emplace(std::move(new_value));
+        }
+        w->ready();
+    }
+
+    template <typename... Args> void emplace(Args &&...args) {
+        async_waiter *w;
+        {
+            std::lock_guard<Mutex> lk(mtx);
+            w = take_async_waiter();
+            if (!w) {
+                data_queue.emplace(std::forward<Args>(args)...);
+                notify_added(1);
+                return;
+            }
+            w->value.emplace(std::forward<Args>(args)...);
+        }
+        w->ready();
+    }
+
+    // Pushes [first, last) under one lock; only as many waiters as there are
+    // new elements are woken.
+    template <typename InputIt> void push_range(InputIt first, InputIt last) {
+        std::vector<async_waiter *> served;
+        {
+            std::lock_guard<Mutex> lk(mtx);
+            std::size_t count = 0;
+            for (; first != last; ++first) {
+                if (async_waiter *w = take_async_waiter()) {
+                    w->value.emplace(*first);
+                    served.push_back(w);
+                } else {
+                    data_queue.push(*first);
+                    ++count;
+                }
+            }
+            notify_added(count);
+        }
+        for (async_waiter *w : served) {
+            w->ready();
+        }
+    }
+
+    // Takes an element into `w.value` and returns true if there is one;
+    // otherwise queues `w` for the next push, which may call w.ready() before
+    // this returns.
+    bool try_pop_or_wait(async_waiter &w) {
+        std::lock_guard<Mutex> lk(mtx);
+        if (data_queue.empty()) {
+            async_waiters.push_back(&w);
+            return false;
+        }
+        w.value.emplace(std::move(data_queue.front()));
+        data_queue.pop();
+        return true;
     }
 
     void wait_and_pop(T &value) {
-        std::unique_lock<std::mutex> lk(mtx);
-        data_cond.wait(lk, [this] { return !data_queue.empty(); });
-        value = data_queue.front();
+        std::unique_lock<Mutex> lk(mtx);
+        wait_for_data(lk);
+        value = std::move(data_queue.front());
         data_queue.pop();
     }
 
     std::shared_ptr<T> wait_and_pop() {
-        std::unique_lock<std::mutex> lk(mtx);
-        data_cond.wait(lk, [this] { return !data_queue.empty(); });
-        std::shared_ptr<T> res(std::make_shared<T>(data_queue.front()));
+        std::unique_lock<Mutex> lk(mtx);
+        wait_for_data(lk);
+        std::shared_ptr<T> res(
+            std::make_shared<T>(std::move(data_queue.front())));
+        data_queue.pop();
+        return res;
+    }
+
+    // Like wait_and_pop(), but returns the value itself instead of a
+    // heap-allocated copy.
+    T wait_and_pop_value() {
+        std::unique_lock<Mutex> lk(mtx);
+        wait_for_data(lk);
+        T res(std::move(data_queue.front()));
         data_queue.pop();
         return res;
     }
 
     bool try_pop(T &value) {
-        std::lock_guard<std::mutex> lk(mtx);
+        std::lock_guard<Mutex> lk(mtx);
         if (data_queue.empty()) {
             return false;
         }
-        value = data_queue.front();
+        value = std::move(data_queue.front());
         data_queue.pop();
         return true;
     }
 
     std::shared_ptr<T> try_pop() {
-        std::lock_guard<std::mutex> lk(mtx);
+        std::lock_guard<Mutex> lk(mtx);
         if (data_queue.empty()) {
             return std::shared_ptr<T>();
         }
-        std::shared_ptr<T> res(std::make_shared<T>(data_queue.front()));
+        std::shared_ptr<T> res(
+            std::make_shared<T>(std::move(data_queue.front())));
+        data_queue.pop();
+        return res;
+    }
+
+    // Like try_pop(), but returns the value itself instead of a
+    // heap-allocated copy.
+    std::optional<T> try_pop_value() {
+        std::lock_guard<Mutex> lk(mtx);
+        if (data_queue.empty()) {
+            return std::nullopt;
+        }
+        std::optional<T> res(std::move(data_queue.front()));
         data_queue.pop();
         return res;
     }
 
+    // Moves up to `max_count` elements to `out` in one critical section and
+    // returns how many were taken.
+    template <typename OutputIt>
+    std::size_t pop_many(OutputIt out, std::size_t max_count) {
+        std::lock_guard<Mutex> lk(mtx);
+        return pop_many_locked(out, max_count);
+    }
+
+    // Waits until at least `min_count` elements are available or `timeout`
+    // has passed, then moves up to `max_count` of them to `out`. Returns how
+    // many were taken, which is less than `min_count` only on timeout.
+    template <typename OutputIt, typename Rep, typename Period>
+    std::size_t wait_and_pop_many(OutputIt out, std::size_t min_count,
+                                  std::size_t max_count,
+                                  const std::chrono::duration<Rep, Period> &timeout) {
+        std::unique_lock<Mutex> lk(mtx);
+        const bool batch = min_count > 1;
+        ++waiters;
+        batch_waiters += batch;
+        data_cond.wait_for(lk, timeout,
+                           [&] { return data_queue.size() >= min_count; });
+        --waiters;
+        batch_waiters -= batch;
+        return pop_many_locked(out, max_count);
+    }
+
     bool empty() const {
-        std::lock_guard<std::mutex> lk(mtx);
+        std::lock_guard<Mutex> lk(mtx);
         return data_queue.empty();
     }
 };
@@ -0,0 +1,142 @@
+// Sharing immutable snapshots through an atomic shared_ptr
+//
+// usage: demo_5_10 [max reader threads]
+// First several threads build a counter out of immutable snapshots with
+// compare_exchange_strong, which must not lose an update. Then readers load
+// the current snapshot in a loop while one writer publishes a new one every
+// 10us, through atomic_shared_ptr with each of its word layouts, and
+// through std::atomic_load/std::atomic_store on a std::shared_ptr, which
+// libstdc++ implements with a pool of mutexes. Reported are million loads
+// per second; at the end no snapshot may be left alive.
+#include "demo_5_9.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+std::atomic<long> live_snapshots(0);
+
+struct snapshot {
+    long version;
+    long payload[7];
+
+    explicit snapshot(long v) : version(v) {
+        std::fill(std::begin(payload), std::end(payload), v);
+        ++live_snapshots;
+    }
+
+    snapshot(const snapshot &) = delete;
+    snapshot &operator=(const snapshot &) = delete;
+
+    ~snapshot() { --live_snapshots; }
+};
+
+template <typename Word> bool counter_works(int threads) {
+    const long increments = 20000;
+    atomic_shared_ptr<snapshot, Word> counter(std::make_shared<snapshot>(0));
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            for (long i = 0; i < increments; ++i) {
+                std::shared_ptr<snapshot> expected = counter.load();
+                while (!counter.compare_exchange_strong(
+                    expected, std::make_shared<snapshot>(expected->version + 1))) {
+                }
+            }
+        });
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+    return counter.load()->version == threads * increments;
+}
+
+template <typename Word> struct split_count_cell {
+    atomic_shared_ptr<snapshot, Word> current{std::make_shared<snapshot>(0)};
+
+    std::shared_ptr<snapshot> load() const { return current.load(); }
+    void store(std::shared_ptr<snapshot> s) { current.store(std::move(s)); }
+};
+
+struct std_atomic_functions_cell {
+    std::shared_ptr<snapshot> current = std::make_shared<snapshot>(0);
+
+    std::shared_ptr<snapshot> load() const { return std::atomic_load(&current); }
+    void store(std::shared_ptr<snapshot> s) {
+        std::atomic_store(&current, std::move(s));
+    }
+};
+
+template <typename Cell> double load_rate(int readers) {
+    Cell cell;
+    std::atomic<bool> done(false);
+    std::atomic<long> loads(0);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&] {
+            long n = 0, last_version = 0;
+            for (; !done.load(std::memory_order_relaxed); ++n) {
+                const auto s = cell.load();
+                if (s->version < last_version || s->payload[6] != s->version) {
+                    std::cerr << "inconsistent snapshot" << std::endl;
+                    std::abort();
+                }
+                last_version = s->version;
+            }
+            loads += n;
+        });
+    }
+    std::thread writer([&] {
+        for (long v = 1; !done.load(std::memory_order_relaxed); ++v) {
+            cell.store(std::make_shared<snapshot>(v));
+            std::this_thread::sleep_for(std::chrono::microseconds(10));
+        }
+    });
+    const auto duration = std::chrono::milliseconds(200);
+    std::this_thread::sleep_for(duration);
+    done = true;
+    writer.join();
+    for (auto &t : threads) {
+        t.join();
+    }
+    return loads / (duration.count() * 1000.0);
+}
+
+int main(int argc, char *argv[]) {
+    const int max_readers =
+        argc > 1 ? std::atoi(argv[1])
+                 : std::max(1u, std::thread::hardware_concurrency());
+    std::cout << std::boolalpha << "atomic_shared_ptr lock free: "
+              << atomic_shared_ptr<snapshot>().is_lock_free()
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+              << ", uses double-width CAS"
+#else
+              << ", packs the count into pointer bits"
+#endif
+              << "\ncompare_exchange counter correct: "
+              << counter_works<split_count::default_word>(4)
+              << "\n\nmillion loads/s, one writer storing every 10us\n"
+              << "readers  std::atomic_load  atomic_shared_ptr";
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+    std::cout << " (double width)  atomic_shared_ptr (packed)";
+#endif
+    std::cout << std::fixed << std::setprecision(2) << std::endl;
+    for (int readers = 1; readers <= max_readers; readers *= 2) {
+        std::cout << std::left << std::setw(9) << readers << std::setw(18)
+                  << load_rate<std_atomic_functions_cell>(readers)
+                  << std::setw(32)
+                  << load_rate<split_count_cell<split_count::default_word>>(
+                         readers);
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+        std::cout << load_rate<split_count_cell<split_count::packed_word>>(
+            readers);
+#endif
+        std::cout << std::right << std::endl;
+    }
+    std::cout << "snapshots still alive: " << live_snapshots << std::endl;
+}
@@ -0,0 +1,327 @@
+// Spinlocks that scale: TTAS with backoff, ticket, MCS and CLH locks
+//
+// All four satisfy Lockable (lock, try_lock, unlock), so they work with
+// std::lock_guard, std::unique_lock and std::lock, and can replace the
+// std::mutex of X in listing_3_6.cc. They need lock-free atomics of the
+// kinds demo_5_2.cc and demo_5_3.cc probe for; the static_asserts below
+// check that.
+//
+// - ttas_spinlock: waiters spin reading the lock word and only try to take
+//   it when it looks free, backing off exponentially after a failed try.
+//   Simple and fast when lightly contended, unfair.
+// - ticket_lock: FIFO. Waiters take a ticket and spin until it is served;
+//   they still all spin on the same cache line.
+// - mcs_lock: FIFO queue of nodes; every waiter spins on its own node, which
+//   its predecessor writes once at handover.
+// - clh_lock: FIFO queue as well, every waiter spins on its predecessor's
+//   node.
+//
+// The queue locks need a node per acquisition. Since the Lockable interface
+// has nowhere to pass one, they take nodes from a per-thread cache and
+// remember the holder's node in the lock.
+#ifndef SPINLOCKS_HPP
+#define SPINLOCKS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+static_assert(std::atomic<bool>::is_always_lock_free,
+              "spinlocks need lock-free std::atomic<bool>");
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free,
+              "spinlocks need lock-free std::atomic<std::uint32_t>");
+static_assert(std::atomic<void *>::is_always_lock_free,
+              "spinlocks need lock-free atomic pointers");
+
+namespace spinlock_detail {
+
+constexpr std::size_t cache_line_size = 64;
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Exponential backoff, yielding the time slice once it gets long so that
+// an oversubscribed machine still makes progress.
+class backoff {
+private:
+    static constexpr unsigned max_rounds = 1024;
+    unsigned rounds = 1;
+
+public:
+    void pause() {
+        if (rounds < max_rounds) {
+            for (unsigned i = 0; i < rounds; ++i) {
+                cpu_relax();
+            }
+            rounds *= 2;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+};
+
+// Spins until `pred` holds, yielding now and then.
+template <typename Predicate> void spin_until(Predicate pred) {
+    for (unsigned i = 0; !pred(); ++i) {
+        if (i < 1024) {
+            cpu_relax();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+// Free queue nodes of the calling thread. A node is in a cache exactly when
+// no lock references it.
+template <typename Node> class node_cache {
+private:
+    static constexpr std::size_t max_cached = 16;
+    std::vector<Node *> nodes;
+
+public:
+    ~node_cache() {
+        for (Node *n : nodes) {
+            delete n;
+        }
+    }
+
+    Node *get() {
+        if (nodes.empty()) {
+            return new Node;
+        }
+        Node *n = nodes.back();
+        nodes.pop_back();
+        return n;
+    }
+
+    void put(Node *n) {
+        if (nodes.size() < max_cached) {
+            nodes.push_back(n);
+        } else {
+            delete n;
+        }
+    }
+
+    static node_cache &this_thread() {
+        thread_local node_cache cache;
+        return cache;
+    }
+};
+
+} // namespace spinlock_detail
+
+class ttas_spinlock {
+private:
+    std::atomic<bool> locked;
+
+public:
+    ttas_spinlock() noexcept : locked(false) {}
+
+    ttas_spinlock(const ttas_spinlock &) = delete;
+    ttas_spinlock &operator=(const ttas_spinlock &) = delete;
+
+    void lock() {
+        spinlock_detail::backoff b;
+        for (;;) {
+            while (locked.load(std::memory_order_relaxed)) {
+                spinlock_detail::cpu_relax();
+            }
+            if (!locked.exchange(true, std::memory_order_acquire)) {
+                return;
+            }
+            b.pause();
+        }
+    }
+
+    bool try_lock() {
+        return !locked.load(std::memory_order_relaxed) &&
+               !locked.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock() { locked.store(false, std::memory_order_release); }
+};
+
+class ticket_lock {
+private:
+    alignas(spinlock_detail::cache_line_size) std::atomic<std::uint32_t>
+        next_ticket;
+    alignas(spinlock_detail::cache_line_size) std::atomic<std::uint32_t>
+        now_serving;
+
+public:
+    ticket_lock() noexcept : next_ticket(0), now_serving(0) {}
+
+    ticket_lock(const ticket_lock &) = delete;
+    ticket_lock &operator=(const ticket_lock &) = delete;
+
+    void lock() {
+        const std::uint32_t ticket =
+            next_ticket.fetch_add(1, std::memory_order_relaxed);
+        for (;;) {
+            const std::uint32_t serving =
+                now_serving.load(std::memory_order_acquire);
+            if (serving == ticket) {
+                return;
+            }
+            // back off in proportion to our place in the line
+            const std::uint32_t ahead = ticket - serving;
+            if (ahead > 8) {
+                std::this_thread::yield();
+            } else {
+                for (std::uint32_t i = 0; i < ahead * 32; ++i) {
+                    spinlock_detail::cpu_relax();
+                }
+            }
+        }
+    }
+
+    bool try_lock() {
+        std::uint32_t serving = now_serving.load(std::memory_order_acquire);
+        return next_ticket.compare_exchange_strong(serving, serving + 1,
+                                                   std::memory_order_acquire,
+                                                   std::memory_order_relaxed);
+    }
+
+    void unlock() {
+        now_serving.store(now_serving.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_release);
+    }
+};
+
+class mcs_lock {
+private:
+    struct alignas(spinlock_detail::cache_line_size) node {
+        std::atomic<node *> next{nullptr};
+        std::atomic<bool> locked{false};
+    };
+
+    using cache = spinlock_detail::node_cache<node>;
+
+    std::atomic<node *> tail;
+    // only accessed by the holder
+    node *holder;
+
+public:
+    mcs_lock() noexcept : tail(nullptr), holder(nullptr) {}
+
+    mcs_lock(const mcs_lock &) = delete;
+    mcs_lock &operator=(const mcs_lock &) = delete;
+
+    void lock() {
+        node *me = cache::this_thread().get();
+        me->next.store(nullptr, std::memory_order_relaxed);
+        me->locked.store(true, std::memory_order_relaxed);
+        node *pred = tail.exchange(me, std::memory_order_acq_rel);
+        if (pred) {
+            pred->next.store(me, std::memory_order_release);
+            spinlock_detail::spin_until(
+                [me] { return !me->locked.load(std::memory_order_acquire); });
+        }
+        holder = me;
+    }
+
+    bool try_lock() {
+        node *me = cache::this_thread().get();
+        me->next.store(nullptr, std::memory_order_relaxed);
+        node *expected = nullptr;
+        if (!tail.compare_exchange_strong(expected, me,
+                                          std::memory_order_acquire,
+                                          std::memory_order_relaxed)) {
+            cache::this_thread().put(me);
+            return false;
+        }
+        holder = me;
+        return true;
+    }
+
+    void unlock() {
+        node *me = holder;
+        node *succ = me->next.load(std::memory_order_acquire);
+        if (!succ) {
+            node *expected = me;
+            if (tail.compare_exchange_strong(expected, nullptr,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed)) {
+                cache::this_thread().put(me);
+                return;
+            }
+            // a successor is linking itself in
+            spinlock_detail::spin_until([&] {
+                return (succ = me->next.load(std::memory_order_acquire)) !=
+                       nullptr;
+            });
+        }
+        succ->locked.store(false, std::memory_order_release);
+        cache::this_thread().put(me);
+    }
+};
+
+// The textbook CLH lock starts with a dummy node and never has an empty
+// queue; this one lets the tail be null when the lock is free, so that
+// try_lock is a single compare-exchange. A holder without successor takes
+// its node back in unlock(); otherwise the successor, the only thread
+// still looking at the node, recycles it once it got the lock.
+class clh_lock {
+private:
+    struct alignas(spinlock_detail::cache_line_size) node {
+        std::atomic<bool> locked{false};
+    };
+
+    using cache = spinlock_detail::node_cache<node>;
+
+    std::atomic<node *> tail;
+    // only accessed by the holder
+    node *holder;
+
+public:
+    clh_lock() noexcept : tail(nullptr), holder(nullptr) {}
+
+    clh_lock(const clh_lock &) = delete;
+    clh_lock &operator=(const clh_lock &) = delete;
+
+    void lock() {
+        node *me = cache::this_thread().get();
+        me->locked.store(true, std::memory_order_relaxed);
+        node *pred = tail.exchange(me, std::memory_order_acq_rel);
+        if (pred) {
+            spinlock_detail::spin_until(
+                [pred] { return !pred->locked.load(std::memory_order_acquire); });
+            cache::this_thread().put(pred);
+        }
+        holder = me;
+    }
+
+    bool try_lock() {
+        node *me = cache::this_thread().get();
+        me->locked.store(true, std::memory_order_relaxed);
+        node *expected = nullptr;
+        if (!tail.compare_exchange_strong(expected, me,
+                                          std::memory_order_acquire,
+                                          std::memory_order_relaxed)) {
+            cache::this_thread().put(me);
+            return false;
+        }
+        holder = me;
+        return true;
+    }
+
+    void unlock() {
+        node *me = holder;
+        node *expected = me;
+        if (tail.compare_exchange_strong(expected, nullptr,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed)) {
+            cache::this_thread().put(me);
+        } else {
+            me->locked.store(false, std::memory_order_release);
+        }
+    }
+};
+
+#endif // end of SPINLOCKS_HPP
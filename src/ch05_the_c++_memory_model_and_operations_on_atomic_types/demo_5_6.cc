@@ -0,0 +1,144 @@
+// Throughput and fairness of std::mutex and the spinlocks of demo_5_5.hpp
+//
+// usage: demo_5_6 [max threads]
+// First Listing 3.6's swap runs with every lock type as X's mutex. Then, for
+// 1, 2, 4 ... threads, every thread acquires the lock in a loop for 200ms
+// and increments a shared counter inside. Reported are million acquisitions
+// per second and two fairness measures over the per-thread counts: Jain's
+// index (1 means all threads got the lock equally often, 1/n that one thread
+// got it every time) and the ratio of the smallest to the largest count.
+#include "demo_5_5.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// X of listing_3_6.cc with the mutex type as a parameter
+template <typename Mutex> class X {
+public:
+    explicit X(int sd) : some_detail(sd) {}
+
+    friend void swap(X &lhs, X &rhs) {
+        if (&lhs == &rhs) {
+            return;
+        }
+        std::lock(lhs.mtx, rhs.mtx);
+        std::lock_guard<Mutex> lock_a(lhs.mtx, std::adopt_lock);
+        std::lock_guard<Mutex> lock_b(rhs.mtx, std::adopt_lock);
+        std::swap(lhs.some_detail, rhs.some_detail);
+    }
+
+    int get() const {
+        std::lock_guard<Mutex> lk(mtx);
+        return some_detail;
+    }
+
+private:
+    int some_detail;
+    mutable Mutex mtx;
+};
+
+// Swaps x1/x2 and x2/x3 from two threads, many times; the values must end
+// up a permutation of 1, 2, 3.
+template <typename Mutex> bool swap_works() {
+    X<Mutex> x1(1), x2(2), x3(3);
+    std::thread t1([&] {
+        for (int i = 0; i < 100000; ++i) {
+            swap(x1, x2);
+        }
+    });
+    std::thread t2([&] {
+        for (int i = 0; i < 100000; ++i) {
+            swap(x2, x3);
+        }
+    });
+    t1.join();
+    t2.join();
+    std::vector<int> v{x1.get(), x2.get(), x3.get()};
+    std::sort(v.begin(), v.end());
+    return v == std::vector<int>{1, 2, 3};
+}
+
+struct result {
+    double mops;
+    double jain_index;
+    double min_max_ratio;
+};
+
+template <typename Mutex> result measure(int threads) {
+    Mutex mtx;
+    long shared_counter = 0;
+    std::atomic<bool> go(false), done(false);
+    std::vector<long> counts(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            while (!go) {
+                std::this_thread::yield();
+            }
+            long n = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                std::lock_guard<Mutex> lk(mtx);
+                ++shared_counter;
+                ++n;
+            }
+            counts[t] = n;
+        });
+    }
+    const auto duration = std::chrono::milliseconds(200);
+    go = true;
+    std::this_thread::sleep_for(duration);
+    done = true;
+    for (auto &w : workers) {
+        w.join();
+    }
+
+    double sum = 0, sum_of_squares = 0;
+    for (long c : counts) {
+        sum += c;
+        sum_of_squares += double(c) * c;
+    }
+    const auto minmax = std::minmax_element(counts.begin(), counts.end());
+    return {sum / (duration.count() * 1000.0),
+            sum_of_squares > 0 ? sum * sum / (threads * sum_of_squares) : 0,
+            *minmax.second > 0 ? double(*minmax.first) / *minmax.second : 0};
+}
+
+template <typename Mutex> void print_row(const std::string &name, int threads) {
+    const result r = measure<Mutex>(threads);
+    std::cout << std::setw(14) << name << std::setw(12) << r.mops
+              << std::setw(12) << r.jain_index << std::setw(12)
+              << r.min_max_ratio << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    std::cout << std::boolalpha << "Listing 3.6 swap with std::mutex: "
+              << swap_works<std::mutex>()
+              << ", ttas_spinlock: " << swap_works<ttas_spinlock>()
+              << ", ticket_lock: " << swap_works<ticket_lock>()
+              << ", mcs_lock: " << swap_works<mcs_lock>()
+              << ", clh_lock: " << swap_works<clh_lock>() << "\n\n";
+
+    const int max_threads =
+        argc > 1 ? std::atoi(argv[1])
+                 : std::max(1u, std::thread::hardware_concurrency());
+    std::cout << std::fixed << std::setprecision(3);
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        std::cout << threads << " threads\n"
+                  << std::setw(14) << "lock" << std::setw(12) << "Macq/s"
+                  << std::setw(12) << "Jain index" << std::setw(12)
+                  << "min/max" << std::endl;
+        print_row<std::mutex>("std::mutex", threads);
+        print_row<ttas_spinlock>("ttas_spinlock", threads);
+        print_row<ticket_lock>("ticket_lock", threads);
+        print_row<mcs_lock>("mcs_lock", threads);
+        print_row<clh_lock>("clh_lock", threads);
+    }
+}
@@ -0,0 +1,131 @@
+// An atomic cell for large trivially copyable types, using a seqlock
+//
+// std::atomic<T> is only lock-free for small T (see demo_5_3.cc); for
+// anything bigger libstdc++ takes a lock from a global table on every load
+// and store, so readers serialize with each other and with unrelated
+// atomics that happen to hash to the same lock.
+//
+// seqlock_atomic<T> keeps a sequence number next to the value. A writer
+// makes it odd, writes the value and makes it even again. A reader reads
+// the sequence, copies the value and reads the sequence again; if both
+// reads saw the same even number, nothing was written in between and the
+// copy is consistent, otherwise it retries. Readers never write shared
+// memory, so any number of them run in parallel.
+//
+// With SingleWriter (the default) only one thread may store, and store() is
+// wait-free. Otherwise writers take turns by claiming the odd sequence
+// number with a compare-exchange.
+//
+// The value is copied word by word with relaxed atomic operations: a reader
+// may see a half-written value, which it then discards, and doing that with
+// plain memcpy would be a data race.
+#ifndef SEQLOCK_ATOMIC_HPP
+#define SEQLOCK_ATOMIC_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+template <typename T, bool SingleWriter = true> class seqlock_atomic {
+private:
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "seqlock_atomic needs a trivially copyable type");
+
+    using word = std::uintptr_t;
+    static constexpr std::size_t word_count =
+        (sizeof(T) + sizeof(word) - 1) / sizeof(word);
+    static constexpr std::size_t cache_line_size = 64;
+
+    alignas(cache_line_size) std::atomic<std::uint64_t> seq;
+    std::atomic<word> words[word_count];
+
+    static_assert(std::atomic<word>::is_always_lock_free &&
+                      std::atomic<std::uint64_t>::is_always_lock_free,
+                  "seqlock_atomic needs lock-free word-sized atomics");
+
+    void write_words(const T &value) {
+        word buffer[word_count] = {};
+        std::memcpy(buffer, &value, sizeof(T));
+        for (std::size_t i = 0; i < word_count; ++i) {
+            words[i].store(buffer[i], std::memory_order_relaxed);
+        }
+    }
+
+    void read_words(T &value) const {
+        word buffer[word_count];
+        for (std::size_t i = 0; i < word_count; ++i) {
+            buffer[i] = words[i].load(std::memory_order_relaxed);
+        }
+        std::memcpy(&value, buffer, sizeof(T));
+    }
+
+    // Makes the sequence odd; returns the even value it had.
+    std::uint64_t begin_write() {
+        if constexpr (SingleWriter) {
+            const std::uint64_t s = seq.load(std::memory_order_relaxed);
+            seq.store(s + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            return s;
+        } else {
+            for (;;) {
+                std::uint64_t s = seq.load(std::memory_order_relaxed);
+                if ((s & 1) == 0 &&
+                    seq.compare_exchange_weak(s, s + 1,
+                                              std::memory_order_acquire,
+                                              std::memory_order_relaxed)) {
+                    std::atomic_thread_fence(std::memory_order_release);
+                    return s;
+                }
+                std::this_thread::yield();
+            }
+        }
+    }
+
+public:
+    explicit seqlock_atomic(const T &initial = T()) : seq(0) {
+        write_words(initial);
+    }
+
+    seqlock_atomic(const seqlock_atomic &) = delete;
+    seqlock_atomic &operator=(const seqlock_atomic &) = delete;
+
+    void store(const T &value) {
+        const std::uint64_t s = begin_write();
+        write_words(value);
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    // One optimistic attempt; false if a store got in the way.
+    bool try_load(T &value) const {
+        const std::uint64_t before = seq.load(std::memory_order_acquire);
+        if (before & 1) {
+            return false;
+        }
+        read_words(value);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return seq.load(std::memory_order_relaxed) == before;
+    }
+
+    T load() const {
+        T value;
+        for (unsigned attempt = 0; !try_load(value); ++attempt) {
+            if (attempt >= 64) {
+                // the writer may have been preempted mid-store
+                std::this_thread::yield();
+            }
+        }
+        return value;
+    }
+
+    operator T() const { return load(); }
+
+    // Number of completed stores; changes whenever the value does.
+    std::uint64_t version() const {
+        return seq.load(std::memory_order_acquire) / 2;
+    }
+};
+
+#endif // end of SEQLOCK_ATOMIC_HPP
@@ -0,0 +1,130 @@
+// Reading a large struct from many threads: std::atomic<BigStruct> vs.
+// std::mutex vs. seqlock_atomic
+//
+// usage: demo_5_8 [max reader threads]
+// (std::atomic<BigStruct> is implemented in libatomic: link with -latomic)
+// One writer stores a new value every microsecond, readers load in a loop
+// and check that all fields of what they got belong to the same store.
+// Reported are million loads per second over all readers.
+#include "demo_5_7.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// about the size of my_data in demo_5_1.cc, but trivially copyable
+struct BigStruct {
+    long version;
+    double d[4];
+    int i[6];
+
+    static BigStruct make(long v) {
+        BigStruct s;
+        s.version = v;
+        std::fill(std::begin(s.d), std::end(s.d), double(v));
+        std::fill(std::begin(s.i), std::end(s.i), int(v));
+        return s;
+    }
+
+    bool consistent() const {
+        return std::all_of(std::begin(d), std::end(d),
+                           [&](double x) { return x == double(version); }) &&
+               std::all_of(std::begin(i), std::end(i),
+                           [&](int x) { return x == int(version); });
+    }
+};
+
+struct std_atomic_cell {
+    std::atomic<BigStruct> value{BigStruct::make(0)};
+
+    void store(const BigStruct &s) { value.store(s); }
+    BigStruct load() const { return value.load(); }
+};
+
+struct mutex_cell {
+    BigStruct value = BigStruct::make(0);
+    mutable std::mutex mtx;
+
+    void store(const BigStruct &s) {
+        std::lock_guard<std::mutex> lk(mtx);
+        value = s;
+    }
+
+    BigStruct load() const {
+        std::lock_guard<std::mutex> lk(mtx);
+        return value;
+    }
+};
+
+struct seqlock_cell {
+    seqlock_atomic<BigStruct> value{BigStruct::make(0)};
+
+    void store(const BigStruct &s) { value.store(s); }
+    BigStruct load() const { return value.load(); }
+};
+
+struct result {
+    double mops;
+    long torn;
+};
+
+template <typename Cell> result measure(int readers) {
+    Cell cell;
+    std::atomic<bool> done(false);
+    std::atomic<long> loads(0), torn(0);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&] {
+            long n = 0, bad = 0;
+            for (; !done.load(std::memory_order_relaxed); ++n) {
+                if (!cell.load().consistent()) {
+                    ++bad;
+                }
+            }
+            loads += n;
+            torn += bad;
+        });
+    }
+    std::thread writer([&] {
+        for (long v = 1; !done.load(std::memory_order_relaxed); ++v) {
+            cell.store(BigStruct::make(v));
+            std::this_thread::sleep_for(std::chrono::microseconds(1));
+        }
+    });
+    const auto duration = std::chrono::milliseconds(200);
+    std::this_thread::sleep_for(duration);
+    done = true;
+    writer.join();
+    for (auto &t : threads) {
+        t.join();
+    }
+    return {loads / (duration.count() * 1000.0), torn.load()};
+}
+
+int main(int argc, char *argv[]) {
+    const int max_readers =
+        argc > 1 ? std::atoi(argv[1])
+                 : std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "sizeof(BigStruct): " << sizeof(BigStruct)
+              << ", std::atomic<BigStruct> lock free: " << std::boolalpha
+              << std::atomic<BigStruct>().is_lock_free() << "\n"
+              << "million loads/s (torn reads)\n"
+              << "readers   std::atomic         std::mutex          "
+                 "seqlock_atomic"
+              << std::fixed << std::setprecision(2) << std::endl;
+    for (int readers = 1; readers <= max_readers; readers *= 2) {
+        const result a = measure<std_atomic_cell>(readers);
+        const result m = measure<mutex_cell>(readers);
+        const result s = measure<seqlock_cell>(readers);
+        std::cout << std::left << std::setw(10) << readers << std::setw(8)
+                  << a.mops << " (" << a.torn << ")\t" << std::setw(8)
+                  << m.mops << " (" << m.torn << ")\t" << std::setw(8)
+                  << s.mops << " (" << s.torn << ")" << std::right
+                  << std::endl;
+    }
+}
@@ -0,0 +1,303 @@
+// A lock-free atomic shared_ptr using split reference counts
+//
+// libstdc++ implements std::atomic_load/atomic_store on std::shared_ptr
+// with a small pool of mutexes picked by address hash. atomic_shared_ptr<T>
+// holds std::shared_ptr<T> values too, but without any lock.
+//
+// Each stored value lives in a control block that owns the shared_ptr. The
+// atomic word holds the control block pointer together with an external
+// count: a reader first increments the external count (one compare-exchange
+// on the whole word, so it cannot race with a replacement), then copies the
+// shared_ptr, which is safe since the block cannot go away meanwhile, then
+// gives its increment back. While the word still points to the same block
+// it decrements the external count; once the block was replaced it
+// decrements the block's internal count instead. Whoever replaces the block
+// moves the outstanding external count to the internal count, and whoever
+// brings the internal count to zero deletes the block. This is the scheme
+// of the lock-free stack with split reference counts in chapter 7.
+//
+// The pointer and the count need to be updated together. With a
+// double-width compare-exchange (x86-64 with -mcx16, which defines
+// __GCC_HAVE_SYNC_COMPARE_AND_SWAP_16) they are two full words; otherwise
+// the count goes into the upper 16 bits of a 64-bit pointer, which user
+// space addresses on x86-64 and AArch64 leave unused. Either way the word
+// is lock-free (compare `is_lock_free()` with the probes in demo_5_2.cc to
+// demo_5_4.cc).
+#ifndef ATOMIC_SHARED_PTR_HPP
+#define ATOMIC_SHARED_PTR_HPP
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace split_count {
+
+struct counted {
+    void *ptr;
+    std::uintptr_t count;
+};
+
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+// pointer and count in two words, updated with cmpxchg16b
+class double_width_word {
+private:
+    using word = unsigned __int128;
+
+    alignas(16) mutable word value;
+
+    static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+                  "load() expects the pointer in the first half");
+
+    static word pack(counted c) {
+        return (word(c.count) << 64) | reinterpret_cast<std::uintptr_t>(c.ptr);
+    }
+
+    static counted unpack(word w) {
+        return {reinterpret_cast<void *>(static_cast<std::uintptr_t>(w)),
+                static_cast<std::uintptr_t>(w >> 64)};
+    }
+
+public:
+    static constexpr std::uintptr_t max_count = UINTPTR_MAX;
+
+    explicit double_width_word(counted c) : value(pack(c)) {}
+
+    // There is no 16-byte atomic load, and a compare-exchange would write to
+    // the line on every read, so the halves are loaded one at a time. The
+    // pair may be torn, but the pointer half is read atomically and callers
+    // only act on it; the count only ever serves as the expected value of a
+    // compare_exchange, which fails on a stale one and returns the real word.
+    counted load() const {
+        const auto *halves = reinterpret_cast<const std::uint64_t *>(&value);
+        const std::uint64_t ptr = __atomic_load_n(&halves[0], __ATOMIC_ACQUIRE);
+        const std::uint64_t count =
+            __atomic_load_n(&halves[1], __ATOMIC_RELAXED);
+        return {reinterpret_cast<void *>(static_cast<std::uintptr_t>(ptr)),
+                static_cast<std::uintptr_t>(count)};
+    }
+
+    bool compare_exchange(counted &expected, counted desired) {
+        const word old = pack(expected);
+        const word seen = __sync_val_compare_and_swap(&value, old, pack(desired));
+        if (seen == old) {
+            return true;
+        }
+        expected = unpack(seen);
+        return false;
+    }
+
+    bool is_lock_free() const { return true; }
+};
+#endif
+
+// pointer in the low 48 bits, count in the high 16 bits
+class packed_word {
+private:
+    static constexpr int pointer_bits = 48;
+    static constexpr std::uint64_t pointer_mask =
+        (std::uint64_t(1) << pointer_bits) - 1;
+
+    std::atomic<std::uint64_t> value;
+
+    static_assert(sizeof(void *) == sizeof(std::uint64_t),
+                  "packing the count into pointer bits needs 64-bit pointers");
+
+    static std::uint64_t pack(counted c) {
+        const auto p = reinterpret_cast<std::uintptr_t>(c.ptr);
+        assert((p & ~pointer_mask) == 0 && "address uses the count bits");
+        return (std::uint64_t(c.count) << pointer_bits) | p;
+    }
+
+    static counted unpack(std::uint64_t w) {
+        return {reinterpret_cast<void *>(
+                    static_cast<std::uintptr_t>(w & pointer_mask)),
+                static_cast<std::uintptr_t>(w >> pointer_bits)};
+    }
+
+public:
+    static constexpr std::uintptr_t max_count =
+        (std::uintptr_t(1) << (64 - pointer_bits)) - 1;
+
+    explicit packed_word(counted c) : value(pack(c)) {}
+
+    counted load() const { return unpack(value.load()); }
+
+    bool compare_exchange(counted &expected, counted desired) {
+        std::uint64_t old = pack(expected);
+        if (value.compare_exchange_strong(old, pack(desired))) {
+            return true;
+        }
+        expected = unpack(old);
+        return false;
+    }
+
+    bool is_lock_free() const { return value.is_lock_free(); }
+};
+
+#if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+using default_word = double_width_word;
+#else
+using default_word = packed_word;
+#endif
+
+} // namespace split_count
+
+template <typename T, typename Word = split_count::default_word>
+class atomic_shared_ptr {
+private:
+    struct control_block {
+        std::shared_ptr<T> value;
+        std::atomic<long> internal_count;
+
+        explicit control_block(std::shared_ptr<T> value_)
+            : value(std::move(value_)), internal_count(0) {}
+    };
+
+    using counted = split_count::counted;
+
+    mutable Word word;
+
+    static control_block *block(counted c) {
+        return static_cast<control_block *>(c.ptr);
+    }
+
+    static counted make_counted(std::shared_ptr<T> p) {
+        // the atomic itself holds one external reference
+        return p ? counted{new control_block(std::move(p)), 1}
+                 : counted{nullptr, 0};
+    }
+
+    // Takes a reference to the current block, if any.
+    counted acquire() const {
+        counted old = word.load();
+        for (;;) {
+            if (!old.ptr) {
+                return old;
+            }
+            // with a full count the other readers will soon give theirs back
+            if (old.count == Word::max_count) {
+                old = word.load();
+                continue;
+            }
+            counted incremented{old.ptr, old.count + 1};
+            if (word.compare_exchange(old, incremented)) {
+                return incremented;
+            }
+        }
+    }
+
+    // Gives back a reference taken by acquire().
+    void release(control_block *b) const {
+        counted cur = word.load();
+        while (cur.ptr == b) {
+            if (word.compare_exchange(cur, counted{b, cur.count - 1})) {
+                return;
+            }
+        }
+        if (b->internal_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete b;
+        }
+    }
+
+    // Called by whoever took `old` out of the word, holding `own_refs` of
+    // its external count through acquire().
+    static std::shared_ptr<T> retire(counted old, long own_refs) {
+        control_block *b = block(old);
+        if (!b) {
+            return nullptr;
+        }
+        std::shared_ptr<T> res = b->value;
+        // the atomic's reference and ours go away, the others move inside
+        const long outstanding = long(old.count) - 1 - own_refs;
+        if (b->internal_count.fetch_add(outstanding,
+                                        std::memory_order_acq_rel) ==
+            -outstanding) {
+            delete b;
+        }
+        return res;
+    }
+
+    static bool equivalent(const std::shared_ptr<T> &a,
+                           const std::shared_ptr<T> &b) {
+        return a == b && !a.owner_before(b) && !b.owner_before(a);
+    }
+
+public:
+    atomic_shared_ptr() : word(counted{nullptr, 0}) {}
+
+    explicit atomic_shared_ptr(std::shared_ptr<T> p)
+        : word(make_counted(std::move(p))) {}
+
+    atomic_shared_ptr(const atomic_shared_ptr &) = delete;
+    atomic_shared_ptr &operator=(const atomic_shared_ptr &) = delete;
+
+    ~atomic_shared_ptr() { retire(word.load(), 0); }
+
+    bool is_lock_free() const { return word.is_lock_free(); }
+
+    std::shared_ptr<T> load() const {
+        const counted c = acquire();
+        if (!c.ptr) {
+            return nullptr;
+        }
+        std::shared_ptr<T> res = block(c)->value;
+        release(block(c));
+        return res;
+    }
+
+    operator std::shared_ptr<T>() const { return load(); }
+
+    std::shared_ptr<T> exchange(std::shared_ptr<T> desired) {
+        const counted fresh = make_counted(std::move(desired));
+        counted old = word.load();
+        while (!word.compare_exchange(old, fresh)) {
+        }
+        return retire(old, 0);
+    }
+
+    void store(std::shared_ptr<T> desired) { exchange(std::move(desired)); }
+
+    // Replaces the value by `desired` if it is equivalent to `expected`
+    // (same pointer, same owner); otherwise loads it into `expected`.
+    bool compare_exchange_strong(std::shared_ptr<T> &expected,
+                                 std::shared_ptr<T> desired) {
+        const counted fresh = make_counted(std::move(desired));
+        for (;;) {
+            counted cur = acquire();
+            const std::shared_ptr<T> current =
+                cur.ptr ? block(cur)->value : nullptr;
+            if (!equivalent(current, expected)) {
+                if (cur.ptr) {
+                    release(block(cur));
+                }
+                delete block(fresh);
+                expected = current;
+                return false;
+            }
+            // other readers may change the count but not the block
+            void *const seen = cur.ptr;
+            while (!word.compare_exchange(cur, fresh)) {
+                if (cur.ptr != seen) {
+                    break;
+                }
+            }
+            if (cur.ptr == seen) {
+                retire(cur, cur.ptr ? 1 : 0);
+                return true;
+            }
+            // replaced meanwhile; our reference moved inside the old block
+            if (seen) {
+                release(static_cast<control_block *>(seen));
+            }
+        }
+    }
+
+    bool compare_exchange_weak(std::shared_ptr<T> &expected,
+                               std::shared_ptr<T> desired) {
+        return compare_exchange_strong(expected, std::move(desired));
+    }
+};
+
+#endif // end of ATOMIC_SHARED_PTR_HPP